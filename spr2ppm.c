@@ -11,16 +11,68 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define MODEX_PLANES 4
 #define BYTES_PER_LINE 32
 #define PALETTE_DATA_OFFSET 0xD
 #define PALETTE_SIZE_COLORS 256
 #define PALETTE_SIZE_BYTES 768 // 3 bytes per color (R,G,B) * 256 colors
-#define MAX_FILENAME_LEN 32
+#define MAX_FILENAME_LEN 256
+#define PPM_CHARS_PER_PIXEL 14 // "RRR GGG BBB   "
+#define PPM_PIXELS_PER_LINE 4
+#define PPM_MAX_HEADER_LEN 32
+#define IO_BENCH_URING_DEPTH 16
+#define SPZ_MAGIC "SPZ1"
+#define SPZ_MAGIC_LEN 4
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+#define SIXEL_BAND_HEIGHT 6
+#define SIXEL_MIN_RUN 4
+#define TILE_SIZE 8
+#define SWIZZLE_BENCH_SAMPLES 4000000
+#define RAYCAST_SCREEN_WIDTH 320
+#define RAYCAST_SCREEN_HEIGHT 200
+#define RAYCAST_MAP_SIZE 16
+#define RAYCAST_BENCH_FRAMES 1000
+#define RAYCAST_MAX_TEXTURES 8
+#define RAYCAST_TRANSPARENT_INDEX 0
+#define CLASSIFY_MAX_SAMPLES 32
+#define MAX_CYCLE_RANGES 8
+#define MAX_CYCLE_FRAMES 256 // enough for a full turn of any range at step 1
+#define CYCLE_FRAME_DELAY_CS 10 // GIF frame delay in hundredths of a second
+#define GIF_MAX_CODE_BITS 12
+#define GIF_HASH_SIZE 5003
+#define MAX_THREADS 64
+#define MAX_RESAMPLE_SIZE 4096
+#define EXR_MAGIC 20000630
+#define EXR_VERSION 2
+#define EXR_CHANNELS 3
+#define EXR_MAX_HEADER_LEN 512
+#define LOG_RING_SIZE 65536 // must be a power of two
+#define LOG_MAX_RECORD 1024
+#define LOG_MAX_THREADS (MAX_THREADS + 1)
+#define LOG_DRAIN_INTERVAL_NS 1000000
 
 // Simple repeating byte pair found in the header of the SPR files,
 // with each pair describing the width/height of each sprite
@@ -38,8 +90,168 @@ typedef struct
   uint8_t b;
 } palette_entry;
 
+// Output strategies compared by the I/O benchmark
+typedef enum
+{
+  IO_BACKEND_STDIO,  // write_ppm_file() as used for normal output
+  IO_BACKEND_FWRITE, // stdio with the same preformatted text as the others
+  IO_BACKEND_WRITE,
+  IO_BACKEND_WRITEV,
+  IO_BACKEND_MMAP,
+  IO_BACKEND_URING,
+  IO_BACKEND_COUNT
+} io_backend;
+
+// File formats that decode_spr() can write for each sprite
+typedef enum
+{
+  OUTPUT_PPM,
+  OUTPUT_INDICES,
+  OUTPUT_RGBA,
+  OUTPUT_GIF,
+  OUTPUT_PFM,
+  OUTPUT_EXR,
+  OUTPUT_FORMAT_COUNT
+} output_format;
+
+// Memory orderings for raw index/RGBA output
+typedef enum
+{
+  LAYOUT_LINEAR,
+  LAYOUT_MORTON,
+  LAYOUT_TILED,
+  LAYOUT_COLUMN,
+  LAYOUT_COUNT
+} pixel_layout;
+
+// Contents of an SPR file held in memory, as read by load_spr()
+typedef struct
+{
+  uint8_t num_sprites;
+  width_height_pair* width_height_data;
+  uint8_t* pixel_data[PALETTE_SIZE_COLORS]; // one buffer per sprite index
+} spr_archive;
+
+// Arrangements in which an SPR file may store each sprite's pixels
+typedef enum
+{
+  SOURCE_LINEAR,
+  SOURCE_PLANAR,
+  SOURCE_COLUMN,
+  SOURCE_AUTO,
+  SOURCE_LAYOUT_COUNT
+} source_layout;
+
+// Reconstruction filters available to the resampler
+typedef enum
+{
+  FILTER_BOX,
+  FILTER_BILINEAR,
+  FILTER_LANCZOS3,
+  FILTER_COUNT
+} resample_filter;
+
+// Precomputed filter taps for resampling one axis from a given source size
+// to the target size: output sample i is the sum of source samples
+// first[i] .. first[i] + count[i] - 1 weighted by weights[i * taps ...]
+typedef struct
+{
+  uint_fast16_t taps;
+  int32_t* first;
+  int32_t* count;
+  float* weights;
+} resample_kernel;
+
+// Filter taps for every sprite width and height that occurs in a file
+typedef struct
+{
+  resample_kernel horizontal[UINT8_MAX + 1];
+  resample_kernel vertical[UINT8_MAX + 1];
+} resample_plan;
+
+// Transformed copies of a sprite that can be output alongside it
+typedef enum
+{
+  VARIANT_MIRROR,   // flipped left to right
+  VARIANT_ROTATE90, // rotated a quarter turn clockwise
+  VARIANT_ROTATE270,
+  VARIANT_COUNT
+} sprite_variant;
+
+// Severity of a log record
+typedef enum
+{
+  LOG_INFO,
+  LOG_ERROR
+} log_level;
+
+// Log records written by one thread and not yet drained. The owning thread
+// only advances head and the drain thread only advances tail, so neither
+// side needs a lock.
+typedef struct
+{
+  uint64_t head;
+  uint64_t tail;
+  char data[LOG_RING_SIZE];
+} log_ring;
+
+// Range of palette entries that rotates by step positions per frame
+typedef struct
+{
+  uint8_t first;
+  uint8_t last;
+  int step;
+} palette_cycle_range;
+
+// Settings that control what decode_spr() produces for each sprite
+typedef struct
+{
+  bool preview;
+  output_format format;
+  pixel_layout layout;
+  source_layout source;
+  unsigned int cycle_frames;
+  unsigned int num_cycle_ranges;
+  palette_cycle_range cycle_ranges[MAX_CYCLE_RANGES];
+  uint_fast16_t resample_width;
+  uint_fast16_t resample_height;
+  resample_filter filter;
+  unsigned int threads;
+  unsigned int variants; // bit mask of (1 << sprite_variant)
+  bool single_sprite;    // output only the sprite at sprite_index
+  uint8_t sprite_index;
+  const resample_plan* plan; // filled in by decode_spr()
+} decode_options;
+
 void linearize_planar_data(uint8_t* planar_data, uint8_t* linear_data, uint_fast16_t pixelcount);
-bool decode_spr(const char* filename, palette_entry* palette);
+bool load_spr(const char* filename, spr_archive* archive);
+void free_spr(spr_archive* archive);
+bool decode_spr(const char* filename, palette_entry* palette, const decode_options* options);
+bool output_sprite(const char* filename_base,
+                   uint8_t sprite_index,
+                   palette_entry* palette,
+                   uint8_t* data,
+                   uint8_t width,
+                   uint8_t height,
+                   const decode_options* options);
+void convert_to_linear(source_layout layout, const uint8_t* src, uint8_t* dst, uint8_t width, uint8_t height);
+source_layout classify_layout(const spr_archive* archive, palette_entry* palette, uint64_t* scores);
+bool preview_sixel(uint8_t sprite_index, palette_entry* palette, uint8_t* data, uint8_t width, uint8_t height);
+bool parse_cycle_range(const char* text, palette_cycle_range* range);
+void cycle_palette(const palette_entry* palette,
+                   palette_entry* cycled,
+                   const palette_cycle_range* ranges,
+                   unsigned int num_ranges,
+                   unsigned int frame);
+bool write_gif(const char* filename_base,
+               uint8_t sprite_index,
+               palette_entry* palette,
+               uint8_t* data,
+               uint8_t width,
+               uint8_t height,
+               const decode_options* options);
+void mirror_sprite(const uint8_t* src, uint8_t* dst, uint8_t width, uint8_t height);
+void rotate_sprite(const uint8_t* src, uint8_t* dst, uint8_t width, uint8_t height, bool clockwise);
 bool read_palette(const char* filename, uint8_t* palette_data);
 bool write_ppm(const char* filename_base,
                uint8_t sprite_index,
@@ -47,6 +259,99 @@ bool write_ppm(const char* filename_base,
                uint8_t* data,
                uint8_t width,
                uint8_t height);
+bool write_ppm_file(const char* filename,
+                    palette_entry* palette,
+                    uint8_t* data,
+                    uint8_t width,
+                    uint8_t height);
+size_t format_ppm_header(char* buffer, uint8_t width, uint8_t height);
+size_t format_ppm_pixels(char* buffer, palette_entry* palette, uint8_t* data, uint_fast16_t pixel_count);
+size_t format_ppm_rgba_pixels(char* buffer, const uint32_t* rgba, size_t pixel_count);
+size_t ppm_pixels_size(size_t pixel_count);
+bool build_resample_kernel(resample_filter filter,
+                           uint_fast16_t src_size,
+                           uint_fast16_t dst_size,
+                           resample_kernel* kernel);
+void free_resample_kernel(resample_kernel* kernel);
+void resample_rgba(const uint32_t* src,
+                   uint_fast16_t src_width,
+                   uint_fast16_t src_height,
+                   uint32_t* dst,
+                   uint_fast16_t dst_width,
+                   uint_fast16_t dst_height,
+                   const resample_kernel* horizontal,
+                   const resample_kernel* vertical,
+                   float* scratch);
+bool write_resampled(const char* filename_base,
+                     uint8_t sprite_index,
+                     palette_entry* palette,
+                     uint8_t* data,
+                     uint8_t width,
+                     uint8_t height,
+                     const decode_options* options);
+void expand_palette_linear(const palette_entry* palette, float (*lut)[4]);
+bool write_float(const char* filename_base,
+                 uint8_t sprite_index,
+                 palette_entry* palette,
+                 uint8_t* data,
+                 uint8_t width,
+                 uint8_t height,
+                 const decode_options* options);
+bool log_start(void);
+void log_stop(void);
+void log_event(log_level level, const char* stage, const char* file, int sprite_index, const char* format, ...)
+  __attribute__((format(printf, 5, 6)));
+bool bench_io(const char* dir, unsigned int file_count);
+void print_usage(const char* progname);
+uint8_t* read_file(const char* filename, size_t* size, const char** error);
+size_t lz_compress_bound(size_t src_len);
+size_t lz_compress(const uint8_t* src, size_t src_len, uint8_t* dst);
+bool lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len);
+bool spz_pack(const char* spr_filename, const char* spz_filename);
+bool spz_unpack(const char* spz_filename, const char* spr_filename);
+bool spz_read_sprite(const uint8_t* archive, size_t archive_size, uint_fast16_t block_index, uint8_t* out);
+bool is_spz_file(const char* filename);
+bool load_spz(const char* filename, spr_archive* archive, const decode_options* options);
+bool parse_name(const char* name, const char* const* names, int count, int* value);
+void expand_palette_rgba(const palette_entry* palette, uint32_t* lut);
+void layout_padded_size(pixel_layout layout,
+                        uint_fast16_t width,
+                        uint_fast16_t height,
+                        uint_fast16_t* padded_width,
+                        uint_fast16_t* padded_height);
+void layout_row_offsets(pixel_layout layout,
+                        uint_fast16_t padded_width,
+                        uint_fast16_t padded_height,
+                        uint_fast16_t y,
+                        uint_fast16_t count,
+                        uint32_t* offsets);
+void swizzle_sprite(pixel_layout layout,
+                    const uint8_t* data,
+                    uint8_t width,
+                    uint8_t height,
+                    const uint32_t* rgba_lut,
+                    uint8_t* out);
+bool write_raw(const char* filename_base,
+               uint8_t sprite_index,
+               palette_entry* palette,
+               uint8_t* data,
+               uint8_t width,
+               uint8_t height,
+               const decode_options* options);
+bool write_output_file(const char* filename, uint8_t sprite_index, const void* buffer, size_t size);
+int perf_counter_open(uint32_t type, uint64_t config);
+int perf_counter_open_l1d_read_misses(void);
+void perf_counter_note_unavailable(void);
+void perf_counter_start(int fd);
+uint64_t perf_counter_stop(int fd);
+bool bench_swizzle(unsigned int sample_count);
+bool bench_raycast(const char* spr_filename, unsigned int frame_count);
+
+static const char* const output_format_names[OUTPUT_FORMAT_COUNT] = { "ppm", "idx", "rgba", "gif", "pfm", "exr" };
+static const char* const pixel_layout_names[LAYOUT_COUNT] = { "linear", "morton", "tiled", "column" };
+static const char* const source_layout_names[SOURCE_LAYOUT_COUNT] = { "linear", "planar", "column", "auto" };
+static const char* const resample_filter_names[FILTER_COUNT] = { "box", "bilinear", "lanczos3" };
+static const char* const sprite_variant_names[VARIANT_COUNT] = { "mirror", "rot90", "rot270" };
 
 /**
  *  Processes a single SPR package of sprite data and a single file containing
@@ -55,29 +360,461 @@ bool write_ppm(const char* filename_base,
 int main (int argc, char** argv)
 {
   int status = 0;
+  const char* bench_name = 0;
+  const char* bench_dir = ".";
+  unsigned int bench_count = 0;
+  bool pack = false;
+  bool unpack = false;
+  decode_options options = { 0 };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:d:n:zupf:l:L:a:r:s:k:j:t:x:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'b':
+      bench_name = optarg;
+      break;
+    case 'd':
+      bench_dir = optarg;
+      break;
+    case 'n':
+      bench_count = strtoul(optarg, 0, 10);
+      break;
+    case 'z':
+      pack = true;
+      break;
+    case 'u':
+      unpack = true;
+      break;
+    case 'p':
+      options.preview = true;
+      break;
+    case 'f':
+      if (!parse_name(optarg, output_format_names, OUTPUT_FORMAT_COUNT, (int*)&options.format))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "unknown output format '%s'", optarg);
+        return -5;
+      }
+      break;
+    case 'l':
+      if (!parse_name(optarg, pixel_layout_names, LAYOUT_COUNT, (int*)&options.layout))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "unknown pixel layout '%s'", optarg);
+        return -5;
+      }
+      break;
+    case 'L':
+      if (!parse_name(optarg, source_layout_names, SOURCE_LAYOUT_COUNT, (int*)&options.source))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "unknown source layout '%s'", optarg);
+        return -5;
+      }
+      break;
+    case 'a':
+    {
+      char* end = 0;
+      const unsigned long frames = strtoul(optarg, &end, 10);
+      if ((optarg[0] == '-') || (end == optarg) || *end || (frames == 0) || (frames > MAX_CYCLE_FRAMES))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "frame count must be between 1 and %d", MAX_CYCLE_FRAMES);
+        return -5;
+      }
+      options.cycle_frames = frames;
+      break;
+    }
+    case 'r':
+      if ((options.num_cycle_ranges == MAX_CYCLE_RANGES) ||
+          !parse_cycle_range(optarg, &options.cycle_ranges[options.num_cycle_ranges]))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "invalid palette cycle range '%s' (at most %d ranges)",
+                  optarg, MAX_CYCLE_RANGES);
+        return -5;
+      }
+      ++options.num_cycle_ranges;
+      break;
+    case 's':
+    {
+      unsigned long width = 0;
+      unsigned long height = 0;
+      if ((sscanf(optarg, "%lux%lu", &width, &height) != 2) ||
+          (width == 0) || (width > MAX_RESAMPLE_SIZE) || (height == 0) || (height > MAX_RESAMPLE_SIZE))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "invalid output size '%s' (expected <width>x<height>, at most %d)",
+                  optarg, MAX_RESAMPLE_SIZE);
+        return -5;
+      }
+      options.resample_width = width;
+      options.resample_height = height;
+      break;
+    }
+    case 'k':
+      if (!parse_name(optarg, resample_filter_names, FILTER_COUNT, (int*)&options.filter))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "unknown resampling filter '%s'", optarg);
+        return -5;
+      }
+      break;
+    case 'j':
+      options.threads = strtoul(optarg, 0, 10);
+      if ((options.threads == 0) || (options.threads > MAX_THREADS))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "thread count must be between 1 and %d", MAX_THREADS);
+        return -5;
+      }
+      break;
+    case 'x':
+    {
+      char* end = 0;
+      const unsigned long index = strtoul(optarg, &end, 10);
+      if ((end == optarg) || *end || (index > UINT8_MAX))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "invalid sprite index '%s'", optarg);
+        return -5;
+      }
+      options.single_sprite = true;
+      options.sprite_index = index;
+      break;
+    }
+    case 't':
+    {
+      int variant;
+      if (!parse_name(optarg, sprite_variant_names, VARIANT_COUNT, &variant))
+      {
+        log_event(LOG_ERROR, "options", 0, -1, "unknown sprite variant '%s'", optarg);
+        return -5;
+      }
+      options.variants |= 1u << variant;
+      break;
+    }
+    default:
+      print_usage(argv[0]);
+      return status;
+    }
+  }
+
+  if (bench_name)
+  {
+    if (strcmp(bench_name, "io") == 0)
+    {
+      status = bench_io(bench_dir, bench_count) ? 0 : -3;
+    }
+    else if (strcmp(bench_name, "swizzle") == 0)
+    {
+      status = bench_swizzle(bench_count ? bench_count : SWIZZLE_BENCH_SAMPLES) ? 0 : -3;
+    }
+    else if ((strcmp(bench_name, "raycast") == 0) && (optind < argc))
+    {
+      status = bench_raycast(argv[optind], bench_count ? bench_count : RAYCAST_BENCH_FRAMES) ? 0 : -3;
+    }
+    else
+    {
+      log_event(LOG_ERROR, "options", 0, -1, "unknown benchmark '%s'", bench_name);
+      status = -3;
+    }
+    return status;
+  }
 
-  if (argc < 3)
+  if (argc - optind < 2)
   {
-    printf("Usage: %s <palette_file> <spr_file>\n", argv[0]);
+    print_usage(argv[0]);
     return status;
   }
 
+  if ((options.layout != LAYOUT_LINEAR) && (options.format != OUTPUT_INDICES) && (options.format != OUTPUT_RGBA))
+  {
+    log_event(LOG_ERROR, "options", 0, -1, "pixel layouts other than linear require -f idx or -f rgba");
+    return -5;
+  }
+
+  if (options.resample_width &&
+      (options.preview || (options.layout != LAYOUT_LINEAR) ||
+       ((options.format != OUTPUT_PPM) && (options.format != OUTPUT_RGBA))))
+  {
+    log_event(LOG_ERROR, "options", 0, -1, "resampling (-s) requires -f ppm or -f rgba with the linear layout");
+    return -5;
+  }
+
+  if (options.cycle_frames && options.preview)
+  {
+    log_event(LOG_ERROR, "options", 0, -1, "palette cycling (-a) applies to file output and cannot be used with -p");
+    return -5;
+  }
+
+  if (options.cycle_frames && !options.num_cycle_ranges)
+  {
+    log_event(LOG_ERROR, "options", 0, -1, "palette cycling (-a) requires at least one range (-r)");
+    return -5;
+  }
+
+  if (options.num_cycle_ranges && !options.cycle_frames)
+  {
+    log_event(LOG_ERROR, "options", 0, -1, "palette cycle ranges (-r) require a frame count (-a)");
+    return -5;
+  }
+
+  if (options.cycle_frames && (options.format == OUTPUT_INDICES))
+  {
+    log_event(LOG_ERROR, "options", 0, -1, "palette cycling (-a) has no effect on palette indices (-f idx)");
+    return -5;
+  }
+
+  if (pack)
+  {
+    return spz_pack(argv[optind], argv[optind + 1]) ? 0 : -4;
+  }
+  else if (unpack)
+  {
+    return spz_unpack(argv[optind], argv[optind + 1]) ? 0 : -4;
+  }
+
+  const char* palette_filename = argv[optind];
+  const char* spr_filename = argv[optind + 1];
   uint8_t palette_data[PALETTE_SIZE_BYTES];
 
-  printf("Reading palette from %s and sprites from %s...\n", argv[1], argv[2]);
+  log_start();
+  log_event(LOG_INFO, "palette", palette_filename, -1, "reading palette");
 
-  if (read_palette(argv[1], palette_data))
+  if (read_palette(palette_filename, palette_data))
   {
-    status = decode_spr(argv[2], (palette_entry*)palette_data) ? 0 : -2;
+    status = decode_spr(spr_filename, (palette_entry*)palette_data, &options) ? 0 : -2;
   }
   else
   {
     status = -1;
   }
 
+  log_stop();
+
   return status;
 }
 
+/**
+ * Prints the command line syntax.
+ */
+void print_usage(const char* progname)
+{
+  printf("Usage: %s [-p] [-f <format>] [-l <layout>] [-L <source_layout>]\n"
+         "          [-a <frames> -r <first>-<last>[:<step>] ...] [-s <width>x<height>]\n"
+         "          [-k <filter>] [-j <threads>] [-t <variant> ...] [-x <index>]\n"
+         "          <palette_file> <spr_file>\n"
+         "       %s -b io [-d <dir>] [-n <file_count>]\n"
+         "       %s -b swizzle [-n <sample_count>]\n"
+         "       %s -b raycast [-n <frame_count>] <spr_file>\n"
+         "       %s -z <spr_file> <spz_file>\n"
+         "       %s -u <spz_file> <spr_file>\n"
+         "\n"
+         "  -p      preview sprites on the terminal as Sixel graphics instead of\n"
+         "          writing PPM files; waits for Enter between sprites on a tty\n"
+         "  -f      output format: ppm (default), idx (raw 8-bit palette indices),\n"
+         "          rgba (raw 32-bit pixels), gif, or linear-light 32-bit float\n"
+         "          RGB as pfm (Portable FloatMap) or exr (uncompressed OpenEXR)\n"
+         "  -l      memory layout for idx/rgba output: linear (default), morton\n"
+         "          (Z-order, padded to a power-of-two square), tiled (8x8 tiles\n"
+         "          in row-major order, padded to a multiple of 8) or column\n"
+         "          (column-major)\n"
+         "  -L      pixel layout of the SPR data: linear (default), planar (VGA\n"
+         "          Mode X), column (column-major) or auto (classify a sample of\n"
+         "          sprites and use the best-scoring layout for the whole file)\n"
+         "  -a      render this many frames of palette cycling per sprite: an\n"
+         "          animated GIF with -f gif, otherwise one file per frame named\n"
+         "          <spr_file>_f<frame>_<sprite> (at most 256 frames)\n"
+         "  -r      palette entries to rotate by <step> (default 1, may be\n"
+         "          negative) positions per frame; may be given up to 8 times\n"
+         "  -s      resample every sprite to this size (ppm and rgba output)\n"
+         "  -k      resampling filter: box, bilinear or lanczos3 (default: box)\n"
+         "  -j      number of threads that output sprites in parallel\n"
+         "          (default: 1; the Sixel preview always uses one)\n"
+         "  -t      also output a transformed copy of every sprite: mirror (left to\n"
+         "          right), rot90 (clockwise) or rot270; may be given more than\n"
+         "          once, and names the files <spr_file>_<variant>_<sprite>\n"
+         "  -x      output only the sprite at this index\n"
+         "  -b io   benchmark the PPM output backends (stdio, fwrite, write,\n"
+         "          writev, mmap, io_uring) with synthetic sprites written to\n"
+         "          <dir>; stdio is write_ppm_file() with per-pixel fprintf,\n"
+         "          the others write text from format_ppm_pixels()\n"
+         "  -d      directory for benchmark output files (default: .)\n"
+         "  -n      number of files per run (default: 10, 100 and 1000)\n"
+         "  -b swizzle\n"
+         "          compare texture sampling speed and L1 data cache misses of the\n"
+         "          linear, morton, tiled and column layouts (-n sets the sample\n"
+         "          count)\n"
+         "  -b raycast\n"
+         "          render a fixed camera path through a headless raycaster that\n"
+         "          uses the SPR sprites as wall and billboard textures, and\n"
+         "          compare frame rates and L1 data cache misses of each texture\n"
+         "          layout (-n sets the frame count)\n"
+         "  -z      pack an SPR file into a compressed SPZ archive\n"
+         "  -u      restore the original SPR file from an SPZ archive\n"
+         "\n"
+         "<spr_file> may also be an SPZ archive, in which case only the sprites\n"
+         "that are output are decompressed (just one with -x). Progress and\n"
+         "errors are written to stderr as JSON lines.\n",
+         progname, progname, progname, progname, progname, progname);
+}
+
+/**
+ * Converts one sprite from the given source layout to row-major order. For
+ * the planar layout, any pixels beyond the last multiple of four (which
+ * linearize_planar_data() cannot place) are copied as they are.
+ */
+void convert_to_linear(source_layout layout, const uint8_t* src, uint8_t* dst, uint8_t width, uint8_t height)
+{
+  const uint_fast16_t pixel_count = width * height;
+
+  if (layout == SOURCE_PLANAR)
+  {
+    const uint_fast16_t planar_count = pixel_count & ~(MODEX_PLANES - 1);
+    linearize_planar_data((uint8_t*)src, dst, planar_count);
+    memcpy(dst + planar_count, src + planar_count, pixel_count - planar_count);
+  }
+  else if (layout == SOURCE_COLUMN)
+  {
+    for (uint_fast16_t x = 0; x < width; ++x)
+    {
+      for (uint_fast16_t y = 0; y < height; ++y)
+      {
+        dst[(y * width) + x] = src[(x * height) + y];
+      }
+    }
+  }
+  else
+  {
+    memcpy(dst, src, pixel_count);
+  }
+}
+
+/**
+ * Sums the absolute luma differences between horizontally and vertically
+ * adjacent pixels of a row-major image. Smooth, correctly arranged images
+ * score low; images decoded with the wrong layout are full of seams and
+ * score high. Sixteen pixels at a time are compared with SSE2 SAD.
+ */
+static uint64_t neighbor_difference(const uint8_t* luma, uint_fast16_t width, uint_fast16_t height)
+{
+  uint64_t total = 0;
+
+  for (uint_fast16_t y = 0; y < height; ++y)
+  {
+    const uint8_t* row = luma + (y * width);
+    const uint8_t* next = (y + 1 < height) ? row + width : 0;
+    uint_fast16_t x = 0;
+
+#ifdef __SSE2__
+    __m128i sums = _mm_setzero_si128();
+
+    for (; x + 16 < width; x += 16)
+    {
+      const __m128i pixels = _mm_loadu_si128((const __m128i*)(row + x));
+      sums = _mm_add_epi64(sums, _mm_sad_epu8(pixels, _mm_loadu_si128((const __m128i*)(row + x + 1))));
+      if (next)
+      {
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(pixels, _mm_loadu_si128((const __m128i*)(next + x))));
+      }
+    }
+    total += (uint64_t)_mm_cvtsi128_si32(sums) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#endif
+    for (; x < width; ++x)
+    {
+      if (x + 1 < width)
+      {
+        total += abs(row[x] - row[x + 1]);
+      }
+      if (next)
+      {
+        total += abs(row[x] - next[x]);
+      }
+    }
+  }
+
+  return total;
+}
+
+/**
+ * Guesses how an SPR file arranges its pixel data by decoding a sample of
+ * its sprites in each candidate layout and comparing neighbor differences of
+ * the resulting luma images. Palette indices are mapped to luma first, since
+ * index values alone need not be ordered by brightness. The per-layout
+ * scores (average difference per pixel, scaled by 1000) are stored in scores,
+ * which must hold SOURCE_AUTO entries. Linear wins ties.
+ */
+source_layout classify_layout(const spr_archive* archive, palette_entry* palette, uint64_t* scores)
+{
+  uint8_t luma_lut[PALETTE_SIZE_COLORS];
+  uint8_t* linear = malloc(UINT8_MAX * UINT8_MAX);
+  uint8_t* luma = malloc(UINT8_MAX * UINT8_MAX);
+  unsigned int candidates = 0;
+  size_t sampled_pixels = 0;
+  source_layout best = SOURCE_LINEAR;
+
+  memset(scores, 0, SOURCE_AUTO * sizeof(uint64_t));
+
+  if (!linear || !luma)
+  {
+    free(linear);
+    free(luma);
+    return SOURCE_LINEAR;
+  }
+
+  for (int color = 0; color < PALETTE_SIZE_COLORS; ++color)
+  {
+    luma_lut[color] = ((palette[color].r * 77) + (palette[color].g * 150) + (palette[color].b * 29)) >> 8;
+  }
+
+  // candidate sprites: big enough for neighbors to mean something, and
+  // a multiple of four pixels so that every layout applies in full
+  for (uint_fast16_t sprite_index = 0; sprite_index < archive->num_sprites; ++sprite_index)
+  {
+    const width_height_pair* size = &archive->width_height_data[sprite_index];
+    if (archive->pixel_data[sprite_index] && (size->width >= 4) && (size->height >= 4) &&
+        ((size->width * size->height) % MODEX_PLANES == 0))
+    {
+      ++candidates;
+    }
+  }
+
+  // take evenly spaced samples from across the file
+  const unsigned int stride = (candidates + CLASSIFY_MAX_SAMPLES - 1) / CLASSIFY_MAX_SAMPLES;
+  unsigned int candidate = 0;
+
+  for (uint_fast16_t sprite_index = 0; sprite_index < archive->num_sprites; ++sprite_index)
+  {
+    const width_height_pair* size = &archive->width_height_data[sprite_index];
+    const uint_fast16_t pixel_count = size->width * size->height;
+
+    if (!archive->pixel_data[sprite_index] || (size->width < 4) || (size->height < 4) ||
+        (pixel_count % MODEX_PLANES != 0) || (candidate++ % stride != 0))
+    {
+      continue;
+    }
+
+    for (int layout = SOURCE_LINEAR; layout < SOURCE_AUTO; ++layout)
+    {
+      convert_to_linear(layout, archive->pixel_data[sprite_index], linear, size->width, size->height);
+      for (uint_fast16_t pixel_index = 0; pixel_index < pixel_count; ++pixel_index)
+      {
+        luma[pixel_index] = luma_lut[linear[pixel_index]];
+      }
+      scores[layout] += neighbor_difference(luma, size->width, size->height);
+    }
+    sampled_pixels += pixel_count;
+  }
+
+  for (int layout = SOURCE_LINEAR; layout < SOURCE_AUTO; ++layout)
+  {
+    scores[layout] = sampled_pixels ? (scores[layout] * 1000) / sampled_pixels : 0;
+    if (scores[layout] < scores[best])
+    {
+      best = layout;
+    }
+  }
+
+  free(linear);
+  free(luma);
+
+  return best;
+}
+
 /**
  * Re-linearizes pixel data that had been separated into four planes
  * for display in VGA Mode X. This was unnecessary for the .SPR data
@@ -118,51 +855,56 @@ bool read_palette(const char* filename, uint8_t* palette_data)
       }
       else
       {
-        fprintf(stderr, "Error: unable to read %d bytes from offset 0x%02X in '%s'.\n",
-                PALETTE_SIZE_BYTES, PALETTE_DATA_OFFSET, filename);
+        log_event(LOG_ERROR, "palette", filename, -1, "unable to read %d bytes from offset 0x%02X",
+                  PALETTE_SIZE_BYTES, PALETTE_DATA_OFFSET);
       }
     }
     else
     {
-      fprintf(stderr, "Error: unable to seek to offset 0x%02X in '%s'.\n", PALETTE_DATA_OFFSET, filename);
+      log_event(LOG_ERROR, "palette", filename, -1, "unable to seek to offset 0x%02X", PALETTE_DATA_OFFSET);
     }
 
     close(fd);
   }
   else
   {
-    fprintf(stderr, "Error: failed to open '%s'.\n", filename);
+    log_event(LOG_ERROR, "palette", filename, -1, "failed to open file");
   }
 
   return status;
 }
 
 /**
- * Reads pixel data for each sprite in an SPR file, combines it with the
- * previously read palette data, and writes a series of .ppm Netpbm pixmaps
- * that each contain a single image.
+ * Reads the header and the pixel data for each sprite in an SPR file into
+ * memory. Sprites with no pixels, and any that could not be read, are left
+ * with a null pixel buffer. The archive must be released with free_spr(),
+ * even if loading failed part of the way through.
  */
-bool decode_spr(const char* filename, palette_entry* pal_data)
+bool load_spr(const char* filename, spr_archive* archive)
 {
   bool status = true;
   width_height_pair* width_height_data = 0;
   uint8_t* pixel_data = 0;
   uint8_t num_sprites = 0;
 
+  memset(archive, 0, sizeof(*archive));
+
   int fd = open(filename, O_RDONLY);
 
   if (fd > 0)
   {
     if (read(fd, &num_sprites, sizeof(num_sprites)) == sizeof(num_sprites))
     {
-      printf("Number of sprites in file: %d\n", num_sprites);
+      log_event(LOG_INFO, "load", filename, -1, "%d sprites in file", num_sprites);
 
       // allocate space for the width/height byte pairs
       const uint16_t header_size = num_sprites * sizeof(width_height_pair);
-      width_height_data = malloc(header_size);
+      width_height_data = malloc(header_size ? header_size : 1);
 
       if (width_height_data)
       {
+        archive->width_height_data = width_height_data;
+
         if (read(fd, width_height_data, header_size) == header_size)
         {
           // for each sprite/texture in the SPR file
@@ -182,58 +924,51 @@ bool decode_spr(const char* filename, palette_entry* pal_data)
                 // read the pixel data from the file for this sprite
                 if (read(fd, pixel_data, pixel_count) == pixel_count)
                 {
-                  if (!write_ppm(filename,
-                                 sprite_index,
-                                 pal_data,
-                                 pixel_data,
-                                 width_height_data[sprite_index].width,
-                                 width_height_data[sprite_index].height))
-                  {
-                    status = false;
-                  }
+                  archive->pixel_data[sprite_index] = pixel_data;
                 }
                 else
                 {
-                  fprintf(stderr, "Error: failed to read %lu bytes of pixel data from '%s'.\n",
-                          pixel_count, filename);
+                  log_event(LOG_ERROR, "load", filename, sprite_index, "failed to read %lu bytes of pixel data",
+                            pixel_count);
                   status = false;
+                  free(pixel_data);
                 }
-
-                free(pixel_data);
               }
               else
               {
-                fprintf(stderr, "Error: failed to allocate %lu bytes for sprite at index %d.",
-                        pixel_count, sprite_index);
+                log_event(LOG_ERROR, "load", filename, sprite_index, "failed to allocate %lu bytes for pixel data",
+                          pixel_count);
                 status = false;
               }
             }
           }
+
+          archive->num_sprites = num_sprites;
         }
         else
         {
-          fprintf(stderr, "Error: failed to read %d bytes of header data from '%s'.\n",
-                  header_size, filename);
+          log_event(LOG_ERROR, "load", filename, -1, "failed to read %d bytes of header data",
+                    header_size);
           status = false;
         }
-
-        free(width_height_data);
       }
       else
       {
-        fprintf(stderr, "Error: failed to allocate %d bytes to buffer header data.\n", header_size);
+        log_event(LOG_ERROR, "load", filename, -1, "failed to allocate %d bytes to buffer header data", header_size);
         status = false;
       }
     }
     else
     {
-      fprintf(stderr, "Error: failed to read sprite count field in header of '%s'\n", filename);
+      log_event(LOG_ERROR, "load", filename, -1, "failed to read sprite count field in header");
       status = false;
     }
+
+    close(fd);
   }
   else
   {
-    fprintf(stderr, "Error: failed to open '%s'.\n", filename);
+    log_event(LOG_ERROR, "load", filename, -1, "failed to open file");
     status = false;
   }
 
@@ -241,48 +976,3693 @@ bool decode_spr(const char* filename, palette_entry* pal_data)
 }
 
 /**
- * Writes a P3-style netpbm (portable pixel map) image.
+ * Releases the memory held by an archive read with load_spr().
  */
-bool write_ppm(const char* filename_base,
-               uint8_t sprite_index,
-               palette_entry* palette,
-               uint8_t* data,
-               uint8_t width,
-               uint8_t height)
+void free_spr(spr_archive* archive)
 {
-  bool status = false;
-  char filename[MAX_FILENAME_LEN];
+  for (uint_fast16_t sprite_index = 0; sprite_index < PALETTE_SIZE_COLORS; ++sprite_index)
+  {
+    free(archive->pixel_data[sprite_index]);
+  }
+  free(archive->width_height_data);
+  memset(archive, 0, sizeof(*archive));
+}
 
-  snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d.ppm", filename_base, sprite_index);
+// Work shared by the threads that output the sprites of one SPR file
+typedef struct
+{
+  const char* filename;
+  const spr_archive* archive;
+  palette_entry* palette;
+  const decode_options* options;
+  source_layout layout;
+  unsigned int next_sprite; // claimed with an atomic fetch-and-add
+  bool status;              // cleared by any thread whose output fails
+} decode_job;
 
-  FILE* fd = fopen(filename, "w");
-  const uint_fast16_t pixel_count = width * height;
-  uint8_t pal_index = 0;
+/**
+ * Thread body for decode_spr(): repeatedly claims the next sprite and
+ * produces its output until none are left.
+ */
+static void* decode_worker(void* arg)
+{
+  decode_job* job = arg;
+  uint8_t* linear_data = malloc(UINT8_MAX * UINT8_MAX);
 
-  if (fd > 0)
+  if (!linear_data)
   {
-    fprintf(fd, "P3\n%d %d\n255", width, height);
+    log_event(LOG_ERROR, "output", job->filename, -1, "failed to allocate %d bytes for linearized pixel data",
+              UINT8_MAX * UINT8_MAX);
+    __atomic_store_n(&job->status, false, __ATOMIC_RELAXED);
+    return 0;
+  }
 
-    for (uint_fast16_t pixel_index = 0; pixel_index < pixel_count; ++pixel_index)
+  for (;;)
+  {
+    const unsigned int sprite_index = __atomic_fetch_add(&job->next_sprite, 1, __ATOMIC_RELAXED);
+
+    if (sprite_index >= job->archive->num_sprites)
+    {
+      break;
+    }
+
+    if (job->archive->pixel_data[sprite_index])
     {
-      if (pixel_index % 4 == 0)
+      const uint8_t width = job->archive->width_height_data[sprite_index].width;
+      const uint8_t height = job->archive->width_height_data[sprite_index].height;
+      uint8_t* data = job->archive->pixel_data[sprite_index];
+
+      if (job->layout != SOURCE_LINEAR)
       {
-        fprintf(fd, "\n");
+        convert_to_linear(job->layout, data, linear_data, width, height);
+        data = linear_data;
       }
-      pal_index = data[pixel_index];
-      fprintf(fd, "%03d %03d %03d   ", palette[pal_index].r,
-                                       palette[pal_index].g,
-                                       palette[pal_index].b);
-    }
 
-    fclose(fd);
-    status = true;
-  }
-  else
-  {
-    fprintf(stderr, "Error: unable to open '%s' for writing.\n", filename);
+      if (output_sprite(job->filename, sprite_index, job->palette, data, width, height, job->options))
+      {
+        log_event(LOG_INFO, "output", job->filename, sprite_index, "wrote %dx%d sprite", width, height);
+      }
+      else
+      {
+        __atomic_store_n(&job->status, false, __ATOMIC_RELAXED);
+      }
+    }
   }
 
-  return status;
+  free(linear_data);
+
+  return 0;
+}
+
+/**
+ * Adds the filter taps for resampling a width x height image to a plan,
+ * unless it already holds them.
+ */
+static bool plan_resample_size(resample_plan* plan, const decode_options* options, uint8_t width, uint8_t height)
+{
+  return (plan->horizontal[width].weights ||
+          build_resample_kernel(options->filter, width, options->resample_width, &plan->horizontal[width])) &&
+         (plan->vertical[height].weights ||
+          build_resample_kernel(options->filter, height, options->resample_height, &plan->vertical[height]));
 }
 
+/**
+ * Reads pixel data for each sprite in an SPR file, combines it with the
+ * previously read palette data, and writes a series of .ppm Netpbm pixmaps
+ * that each contain a single image (or whatever output the options select).
+ * Sprites are output by a pool of threads when more than one is requested.
+ */
+bool decode_spr(const char* filename, palette_entry* pal_data, const decode_options* options)
+{
+  spr_archive archive;
+  bool status = is_spz_file(filename) ? load_spz(filename, &archive, options) : load_spr(filename, &archive);
+  source_layout layout = options->source;
+  uint64_t scores[SOURCE_AUTO] = { 0 };
+  decode_options job_options = *options;
+  resample_plan* plan = 0;
+  unsigned int first_sprite = 0;
+  pthread_t threads[MAX_THREADS];
+  unsigned int num_threads = (options->threads && !options->preview) ? options->threads : 1;
+  unsigned int sprite_count = 0;
+  size_t pixel_total = 0;
+
+  if (options->single_sprite)
+  {
+    if ((options->sprite_index >= archive.num_sprites) || !archive.pixel_data[options->sprite_index])
+    {
+      log_event(LOG_ERROR, "decode", filename, options->sprite_index, "no sprite with pixel data at this index");
+      status = false;
+    }
+
+    // an SPR file is read whole, so drop the sprites that are not wanted
+    for (uint_fast16_t sprite_index = 0; sprite_index < archive.num_sprites; ++sprite_index)
+    {
+      if (sprite_index != options->sprite_index)
+      {
+        free(archive.pixel_data[sprite_index]);
+        archive.pixel_data[sprite_index] = 0;
+      }
+    }
+  }
+
+  if (layout == SOURCE_AUTO)
+  {
+    layout = classify_layout(&archive, pal_data, scores);
+  }
+
+  // filter weights depend only on the source size, so compute them once
+  // for each distinct sprite width and height before any thread starts
+  if (options->resample_width)
+  {
+    plan = calloc(1, sizeof(resample_plan));
+
+    const bool rotated = options->variants & ((1u << VARIANT_ROTATE90) | (1u << VARIANT_ROTATE270));
+
+    for (uint_fast16_t sprite_index = 0; plan && (sprite_index < archive.num_sprites); ++sprite_index)
+    {
+      const width_height_pair* size = &archive.width_height_data[sprite_index];
+
+      if (archive.pixel_data[sprite_index] &&
+          (!plan_resample_size(plan, options, size->width, size->height) ||
+           (rotated && !plan_resample_size(plan, options, size->height, size->width))))
+      {
+        log_event(LOG_ERROR, "decode", filename, -1, "failed to allocate resampling filter weights");
+        status = false;
+        first_sprite = archive.num_sprites; // leave nothing for the workers
+        break;
+      }
+    }
+
+    if (!plan)
+    {
+      log_event(LOG_ERROR, "decode", filename, -1, "failed to allocate resampling plan");
+      free_spr(&archive);
+      return false;
+    }
+    job_options.plan = plan;
+  }
+
+  decode_job job = { filename, &archive, pal_data, &job_options, layout, first_sprite, true };
+
+  for (unsigned int i = 1; i < num_threads; ++i)
+  {
+    if (pthread_create(&threads[i], 0, decode_worker, &job) != 0)
+    {
+      log_event(LOG_ERROR, "decode", filename, -1, "failed to start thread %u; continuing with %u", i, i);
+      num_threads = i;
+    }
+  }
+  decode_worker(&job);
+  for (unsigned int i = 1; i < num_threads; ++i)
+  {
+    pthread_join(threads[i], 0);
+  }
+
+  if (!job.status)
+  {
+    status = false;
+  }
+
+  for (uint_fast16_t sprite_index = 0; sprite_index < archive.num_sprites; ++sprite_index)
+  {
+    if (archive.pixel_data[sprite_index])
+    {
+      ++sprite_count;
+      pixel_total += archive.width_height_data[sprite_index].width * archive.width_height_data[sprite_index].height;
+    }
+  }
+
+  if (options->source == SOURCE_AUTO)
+  {
+    log_event(LOG_INFO, "decode", filename, -1,
+              "decoded %u sprites (%lu pixels), pixel layout: %s (auto; scores linear=%lu planar=%lu column=%lu)",
+              sprite_count, pixel_total, source_layout_names[layout],
+              scores[SOURCE_LINEAR], scores[SOURCE_PLANAR], scores[SOURCE_COLUMN]);
+  }
+  else
+  {
+    log_event(LOG_INFO, "decode", filename, -1, "decoded %u sprites (%lu pixels), pixel layout: %s",
+              sprite_count, pixel_total, source_layout_names[layout]);
+  }
+
+  if (plan)
+  {
+    for (uint_fast16_t size = 0; size <= UINT8_MAX; ++size)
+    {
+      free_resample_kernel(&plan->horizontal[size]);
+      free_resample_kernel(&plan->vertical[size]);
+    }
+    free(plan);
+  }
+  free_spr(&archive);
+
+  return status;
+}
+
+/**
+ * Produces the output selected by the decode options for a single image.
+ */
+static bool output_frame(const char* filename_base,
+                         uint8_t sprite_index,
+                         palette_entry* palette,
+                         uint8_t* data,
+                         uint8_t width,
+                         uint8_t height,
+                         const decode_options* options)
+{
+  if (options->preview)
+  {
+    return preview_sixel(sprite_index, palette, data, width, height);
+  }
+  else if (options->resample_width)
+  {
+    return write_resampled(filename_base, sprite_index, palette, data, width, height, options);
+  }
+  else if (options->format == OUTPUT_GIF)
+  {
+    return write_gif(filename_base, sprite_index, palette, data, width, height, options);
+  }
+  else if ((options->format == OUTPUT_PFM) || (options->format == OUTPUT_EXR))
+  {
+    return write_float(filename_base, sprite_index, palette, data, width, height, options);
+  }
+  else if (options->format != OUTPUT_PPM)
+  {
+    return write_raw(filename_base, sprite_index, palette, data, width, height, options);
+  }
+
+  return write_ppm(filename_base, sprite_index, palette, data, width, height);
+}
+
+/**
+ * Produces the output for one sprite image. With palette cycling, every
+ * frame reuses the same index data and only the palette is rotated; GIF
+ * output holds all frames in one animated file.
+ */
+static bool output_frames(const char* filename_base,
+                          uint8_t sprite_index,
+                          palette_entry* palette,
+                          uint8_t* data,
+                          uint8_t width,
+                          uint8_t height,
+                          const decode_options* options)
+{
+  bool status = true;
+  char frame_base[MAX_FILENAME_LEN];
+  palette_entry cycled[PALETTE_SIZE_COLORS];
+
+  if (!options->cycle_frames || (options->format == OUTPUT_GIF))
+  {
+    return output_frame(filename_base, sprite_index, palette, data, width, height, options);
+  }
+
+  for (unsigned int frame = 0; frame < options->cycle_frames; ++frame)
+  {
+    cycle_palette(palette, cycled, options->cycle_ranges, options->num_cycle_ranges, frame);
+    snprintf(frame_base, MAX_FILENAME_LEN - 1, "%s_f%03u", filename_base, frame);
+
+    if (!output_frame(frame_base, sprite_index, cycled, data, width, height, options))
+    {
+      status = false;
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Produces the output selected by the decode options for a single sprite,
+ * followed by any requested mirrored or rotated variants. The variants are
+ * derived from the decoded index data, one memory pass each.
+ */
+bool output_sprite(const char* filename_base,
+                   uint8_t sprite_index,
+                   palette_entry* palette,
+                   uint8_t* data,
+                   uint8_t width,
+                   uint8_t height,
+                   const decode_options* options)
+{
+  bool status = output_frames(filename_base, sprite_index, palette, data, width, height, options);
+  char variant_base[MAX_FILENAME_LEN];
+  uint8_t* variant_data;
+
+  if (!options->variants)
+  {
+    return status;
+  }
+
+  variant_data = malloc(width * height);
+  if (!variant_data)
+  {
+    log_event(LOG_ERROR, "variant", filename_base, sprite_index, "failed to allocate variant buffer");
+    return false;
+  }
+
+  for (int variant = 0; variant < VARIANT_COUNT; ++variant)
+  {
+    if (options->variants & (1u << variant))
+    {
+      const bool mirror = (variant == VARIANT_MIRROR);
+
+      if (mirror)
+      {
+        mirror_sprite(data, variant_data, width, height);
+      }
+      else
+      {
+        rotate_sprite(data, variant_data, width, height, variant == VARIANT_ROTATE90);
+      }
+      snprintf(variant_base, MAX_FILENAME_LEN - 1, "%s_%s", filename_base, sprite_variant_names[variant]);
+
+      if (!output_frames(variant_base, sprite_index, palette, variant_data,
+                         mirror ? width : height, mirror ? height : width, options))
+      {
+        status = false;
+      }
+    }
+  }
+
+  free(variant_data);
+
+  return status;
+}
+
+#ifdef __SSE2__
+/**
+ * Reverses the order of the 16 bytes in a vector.
+ */
+static inline __m128i reverse_bytes(__m128i v)
+{
+  v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+/**
+ * Transposes an 8x8 block of bytes held in the low halves of rows[], leaving
+ * column 2i in the low half and column 2i+1 in the high half of cols[i].
+ */
+static inline void transpose_8x8(const __m128i* rows, __m128i* cols)
+{
+  const __m128i a0 = _mm_unpacklo_epi8(rows[0], rows[1]);
+  const __m128i a1 = _mm_unpacklo_epi8(rows[2], rows[3]);
+  const __m128i a2 = _mm_unpacklo_epi8(rows[4], rows[5]);
+  const __m128i a3 = _mm_unpacklo_epi8(rows[6], rows[7]);
+  const __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+  const __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+  const __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+  const __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+  cols[0] = _mm_unpacklo_epi32(b0, b2);
+  cols[1] = _mm_unpackhi_epi32(b0, b2);
+  cols[2] = _mm_unpacklo_epi32(b1, b3);
+  cols[3] = _mm_unpackhi_epi32(b1, b3);
+}
+#endif
+
+/**
+ * Flips a sprite left to right. Each row is reversed 16 bytes at a time,
+ * working inwards from both ends of the row.
+ */
+void mirror_sprite(const uint8_t* src, uint8_t* dst, uint8_t width, uint8_t height)
+{
+  for (uint_fast16_t y = 0; y < height; ++y)
+  {
+    const uint8_t* src_row = src + (y * width);
+    uint8_t* dst_row = dst + (y * width);
+    uint_fast16_t x = 0;
+
+#ifdef __SSE2__
+    for (; x + 16 <= width; x += 16)
+    {
+      const __m128i v = _mm_loadu_si128((const __m128i*)(src_row + width - x - 16));
+      _mm_storeu_si128((__m128i*)(dst_row + x), reverse_bytes(v));
+    }
+#endif
+    for (; x < width; ++x)
+    {
+      dst_row[x] = src_row[width - 1 - x];
+    }
+  }
+}
+
+/**
+ * Rotates a sprite a quarter turn, producing a height x width image. The
+ * sprite is processed in 8x8 blocks so that both the reads and the writes
+ * stay within a few cache lines; with SSE2 each block is transposed in
+ * registers. Rotating clockwise reads each block bottom row first, which
+ * reverses the transposed columns.
+ */
+void rotate_sprite(const uint8_t* src, uint8_t* dst, uint8_t width, uint8_t height, bool clockwise)
+{
+  const uint_fast16_t block_width = width & ~7;
+  const uint_fast16_t block_height = height & ~7;
+
+  for (uint_fast16_t by = 0; by < block_height; by += 8)
+  {
+    for (uint_fast16_t bx = 0; bx < block_width; bx += 8)
+    {
+      // destination of source pixel (bx + i, first source row read)
+      const uint_fast16_t dst_col = clockwise ? height - 8 - by : by;
+#ifdef __SSE2__
+      __m128i rows[8];
+      __m128i cols[4];
+
+      for (int r = 0; r < 8; ++r)
+      {
+        rows[r] = _mm_loadl_epi64((const __m128i*)(src + ((by + (clockwise ? 7 - r : r)) * width) + bx));
+      }
+      transpose_8x8(rows, cols);
+
+      for (int i = 0; i < 8; ++i)
+      {
+        const uint_fast16_t dst_row = clockwise ? bx + i : width - 1 - (bx + i);
+        const __m128i col = (i & 1) ? _mm_srli_si128(cols[i / 2], 8) : cols[i / 2];
+        _mm_storel_epi64((__m128i*)(dst + (dst_row * height) + dst_col), col);
+      }
+#else
+      for (int i = 0; i < 8; ++i)
+      {
+        const uint_fast16_t dst_row = clockwise ? bx + i : width - 1 - (bx + i);
+        for (int r = 0; r < 8; ++r)
+        {
+          dst[(dst_row * height) + dst_col + r] = src[((by + (clockwise ? 7 - r : r)) * width) + bx + i];
+        }
+      }
+#endif
+    }
+  }
+
+  // pixels in the partial blocks along the right and bottom edges
+  for (uint_fast16_t y = 0; y < height; ++y)
+  {
+    for (uint_fast16_t x = (y < block_height) ? block_width : 0; x < width; ++x)
+    {
+      const uint_fast16_t dst_row = clockwise ? x : width - 1 - x;
+      const uint_fast16_t dst_col = clockwise ? height - 1 - y : y;
+      dst[(dst_row * height) + dst_col] = src[(y * width) + x];
+    }
+  }
+}
+
+/**
+ * Writes a P3-style netpbm (portable pixel map) image.
+ */
+bool write_ppm(const char* filename_base,
+               uint8_t sprite_index,
+               palette_entry* palette,
+               uint8_t* data,
+               uint8_t width,
+               uint8_t height)
+{
+  char filename[MAX_FILENAME_LEN];
+
+  snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d.ppm", filename_base, sprite_index);
+
+  return write_ppm_file(filename, palette, data, width, height);
+}
+
+/**
+ * Writes a P3-style netpbm image to the file with the provided name.
+ */
+bool write_ppm_file(const char* filename,
+                    palette_entry* palette,
+                    uint8_t* data,
+                    uint8_t width,
+                    uint8_t height)
+{
+  bool status = false;
+  FILE* fd = fopen(filename, "w");
+  const uint_fast16_t pixel_count = width * height;
+  uint8_t pal_index = 0;
+
+  if (fd > 0)
+  {
+    fprintf(fd, "P3\n%d %d\n255", width, height);
+
+    for (uint_fast16_t pixel_index = 0; pixel_index < pixel_count; ++pixel_index)
+    {
+      if (pixel_index % PPM_PIXELS_PER_LINE == 0)
+      {
+        fprintf(fd, "\n");
+      }
+      pal_index = data[pixel_index];
+      fprintf(fd, "%03d %03d %03d   ", palette[pal_index].r,
+                                       palette[pal_index].g,
+                                       palette[pal_index].b);
+    }
+
+    fclose(fd);
+    status = true;
+  }
+  else
+  {
+    log_event(LOG_ERROR, "output", filename, -1, "unable to open file for writing");
+  }
+
+  return status;
+}
+
+/**
+ * Formats the P3 header into the provided buffer, which must hold at least
+ * PPM_MAX_HEADER_LEN bytes. Returns the number of bytes used (no terminator).
+ */
+size_t format_ppm_header(char* buffer, uint8_t width, uint8_t height)
+{
+  return snprintf(buffer, PPM_MAX_HEADER_LEN, "P3\n%d %d\n255", width, height);
+}
+
+/**
+ * Returns the exact size of the text that format_ppm_pixels() (or
+ * format_ppm_rgba_pixels()) produces for the given number of pixels.
+ */
+size_t ppm_pixels_size(size_t pixel_count)
+{
+  return (pixel_count * PPM_CHARS_PER_PIXEL) +
+         ((pixel_count + PPM_PIXELS_PER_LINE - 1) / PPM_PIXELS_PER_LINE);
+}
+
+// Three-digit zero-padded decimal text for every 8-bit value
+static char ppm_decimal[256][3];
+static pthread_once_t ppm_decimal_once = PTHREAD_ONCE_INIT;
+
+static void init_ppm_decimal(void)
+{
+  for (int value = 0; value < 256; ++value)
+  {
+    ppm_decimal[value][0] = '0' + (value / 100);
+    ppm_decimal[value][1] = '0' + ((value / 10) % 10);
+    ppm_decimal[value][2] = '0' + (value % 10);
+  }
+}
+
+/**
+ * Appends one "RRR GGG BBB   " pixel to P3 text.
+ */
+static char* ppm_put_color(char* out, uint8_t r, uint8_t g, uint8_t b)
+{
+  memcpy(out, ppm_decimal[r], 3);
+  out[3] = ' ';
+  memcpy(out + 4, ppm_decimal[g], 3);
+  out[7] = ' ';
+  memcpy(out + 8, ppm_decimal[b], 3);
+  memcpy(out + 11, "   ", 3);
+  return out + PPM_CHARS_PER_PIXEL;
+}
+
+/**
+ * Formats the pixel section of a P3 image into the provided buffer, producing
+ * the same text as write_ppm_file() without going through stdio. The buffer
+ * must hold at least ppm_pixels_size(pixel_count) bytes.
+ */
+size_t format_ppm_pixels(char* buffer, palette_entry* palette, uint8_t* data, uint_fast16_t pixel_count)
+{
+  char* out = buffer;
+
+  pthread_once(&ppm_decimal_once, init_ppm_decimal);
+
+  for (uint_fast16_t pixel_index = 0; pixel_index < pixel_count; ++pixel_index)
+  {
+    const palette_entry* color = &palette[data[pixel_index]];
+
+    if (pixel_index % PPM_PIXELS_PER_LINE == 0)
+    {
+      *out++ = '\n';
+    }
+    out = ppm_put_color(out, color->r, color->g, color->b);
+  }
+
+  return out - buffer;
+}
+
+/**
+ * Formats the pixel section of a P3 image from 32-bit RGBA pixels (alpha is
+ * dropped). The buffer must hold at least ppm_pixels_size(pixel_count) bytes.
+ */
+size_t format_ppm_rgba_pixels(char* buffer, const uint32_t* rgba, size_t pixel_count)
+{
+  char* out = buffer;
+
+  pthread_once(&ppm_decimal_once, init_ppm_decimal);
+
+  for (size_t pixel_index = 0; pixel_index < pixel_count; ++pixel_index)
+  {
+    const uint8_t* color = (const uint8_t*)&rgba[pixel_index];
+
+    if (pixel_index % PPM_PIXELS_PER_LINE == 0)
+    {
+      *out++ = '\n';
+    }
+    out = ppm_put_color(out, color[0], color[1], color[2]);
+  }
+
+  return out - buffer;
+}
+
+/**
+ * Returns the elapsed time in seconds between two monotonic timestamps.
+ */
+static double elapsed_seconds(const struct timespec* start, const struct timespec* end)
+{
+  return (end->tv_sec - start->tv_sec) + ((end->tv_nsec - start->tv_nsec) / 1e9);
+}
+
+#ifdef __linux__
+// Minimal io_uring submission/completion ring, driven with raw syscalls so
+// that the benchmark does not depend on liburing
+typedef struct
+{
+  int ring_fd;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void* sq_ring;
+  void* cq_ring;
+  size_t sq_ring_size;
+  size_t cq_ring_size;
+  size_t sqes_size;
+} uring_context;
+
+/**
+ * Creates an io_uring instance and maps its rings. Returns false if the
+ * kernel (or a seccomp policy) does not allow io_uring.
+ */
+static bool uring_open(uring_context* ctx, unsigned entries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(ctx, 0, sizeof(*ctx));
+
+  ctx->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ctx->ring_fd < 0)
+  {
+    return false;
+  }
+
+  ctx->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+  ctx->cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ctx->cq_ring_size > ctx->sq_ring_size)
+    {
+      ctx->sq_ring_size = ctx->cq_ring_size;
+    }
+    ctx->cq_ring_size = 0;
+  }
+
+  ctx->sq_ring = mmap(0, ctx->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQ_RING);
+  ctx->cq_ring = ctx->cq_ring_size ?
+                 mmap(0, ctx->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_CQ_RING) :
+                 ctx->sq_ring;
+  ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ctx->sqes = mmap(0, ctx->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQES);
+
+  if ((ctx->sq_ring == MAP_FAILED) || (ctx->cq_ring == MAP_FAILED) || (ctx->sqes == MAP_FAILED))
+  {
+    close(ctx->ring_fd);
+    return false;
+  }
+
+  ctx->sq_tail = (unsigned*)((char*)ctx->sq_ring + params.sq_off.tail);
+  ctx->sq_mask = (unsigned*)((char*)ctx->sq_ring + params.sq_off.ring_mask);
+  ctx->sq_array = (unsigned*)((char*)ctx->sq_ring + params.sq_off.array);
+  ctx->cq_head = (unsigned*)((char*)ctx->cq_ring + params.cq_off.head);
+  ctx->cq_tail = (unsigned*)((char*)ctx->cq_ring + params.cq_off.tail);
+  ctx->cq_mask = (unsigned*)((char*)ctx->cq_ring + params.cq_off.ring_mask);
+  ctx->cqes = (struct io_uring_cqe*)((char*)ctx->cq_ring + params.cq_off.cqes);
+
+  return true;
+}
+
+static void uring_close(uring_context* ctx)
+{
+  munmap(ctx->sqes, ctx->sqes_size);
+  if (ctx->cq_ring != ctx->sq_ring)
+  {
+    munmap(ctx->cq_ring, ctx->cq_ring_size);
+  }
+  munmap(ctx->sq_ring, ctx->sq_ring_size);
+  close(ctx->ring_fd);
+}
+
+/**
+ * Submits one write per file descriptor and waits for all of them to
+ * complete. Returns true if every write was completed in full.
+ */
+static bool uring_write_batch(uring_context* ctx, int* fds, char** buffers, size_t* lengths, unsigned count)
+{
+  bool status = true;
+  unsigned tail = *ctx->sq_tail;
+
+  for (unsigned i = 0; i < count; ++i)
+  {
+    const unsigned slot = tail & *ctx->sq_mask;
+    struct io_uring_sqe* sqe = &ctx->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fds[i];
+    sqe->addr = (uintptr_t)buffers[i];
+    sqe->len = lengths[i];
+    sqe->user_data = i;
+    ctx->sq_array[slot] = slot;
+    ++tail;
+  }
+  __atomic_store_n(ctx->sq_tail, tail, __ATOMIC_RELEASE);
+
+  if (syscall(__NR_io_uring_enter, ctx->ring_fd, count, count, IORING_ENTER_GETEVENTS, 0, 0) < 0)
+  {
+    return false;
+  }
+
+  unsigned head = *ctx->cq_head;
+  while (head != __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    const struct io_uring_cqe* cqe = &ctx->cqes[head & *ctx->cq_mask];
+    if ((cqe->res < 0) || ((size_t)cqe->res != lengths[cqe->user_data]))
+    {
+      status = false;
+    }
+    ++head;
+  }
+  __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+
+  return status;
+}
+#endif
+
+/**
+ * Writes file_count copies of a synthetic sprite to the given directory using
+ * one output backend, and returns the number of bytes written (0 on failure).
+ * Every backend produces files that are byte-identical to write_ppm_file().
+ */
+static size_t bench_io_run(io_backend backend,
+                           const char* dir,
+                           unsigned int file_count,
+                           palette_entry* palette,
+                           uint8_t* data,
+                           uint8_t width,
+                           uint8_t height)
+{
+  const uint_fast16_t pixel_count = width * height;
+  const size_t body_size = ppm_pixels_size(pixel_count);
+  const unsigned int batch_size = (backend == IO_BACKEND_URING) ? IO_BENCH_URING_DEPTH : 1;
+  char filename[MAX_FILENAME_LEN];
+  char header[IO_BENCH_URING_DEPTH][PPM_MAX_HEADER_LEN];
+  char* buffers[IO_BENCH_URING_DEPTH];
+  size_t lengths[IO_BENCH_URING_DEPTH];
+  int fds[IO_BENCH_URING_DEPTH];
+  size_t total = 0;
+  bool status = true;
+
+#ifdef __linux__
+  uring_context ring;
+  if ((backend == IO_BACKEND_URING) && !uring_open(&ring, IO_BENCH_URING_DEPTH))
+  {
+    fprintf(stderr, "Error: io_uring is not available on this system.\n");
+    return 0;
+  }
+#else
+  if (backend == IO_BACKEND_URING)
+  {
+    fprintf(stderr, "Error: io_uring is only available on Linux.\n");
+    return 0;
+  }
+#endif
+
+  for (unsigned int i = 0; i < batch_size; ++i)
+  {
+    buffers[i] = malloc(PPM_MAX_HEADER_LEN + body_size);
+    if (!buffers[i])
+    {
+      fprintf(stderr, "Error: failed to allocate %lu bytes for output buffer.\n",
+              PPM_MAX_HEADER_LEN + body_size);
+      status = false;
+    }
+  }
+
+  for (unsigned int file_index = 0; status && (file_index < file_count); file_index += batch_size)
+  {
+    unsigned int batch_count = file_count - file_index;
+    if (batch_count > batch_size)
+    {
+      batch_count = batch_size;
+    }
+
+    unsigned int opened = 0;
+    for (unsigned int i = 0; status && (i < batch_count); ++i)
+    {
+      snprintf(filename, MAX_FILENAME_LEN - 1, "%s/bench_%05u.ppm", dir, file_index + i);
+
+      if (backend == IO_BACKEND_STDIO)
+      {
+        status = write_ppm_file(filename, palette, data, width, height);
+        total += format_ppm_header(header[0], width, height) + body_size;
+        continue;
+      }
+      else if (backend == IO_BACKEND_FWRITE)
+      {
+        // same preformatted text as the other backends, through stdio
+        const size_t header_size = format_ppm_header(buffers[0], width, height);
+        const size_t file_size = header_size + body_size;
+        FILE* fd = fopen(filename, "wb");
+
+        format_ppm_pixels(buffers[0] + header_size, palette, data, pixel_count);
+        status = fd && (fwrite(buffers[0], 1, file_size, fd) == file_size);
+        if (fd && (fclose(fd) != 0))
+        {
+          status = false;
+        }
+        if (!status)
+        {
+          fprintf(stderr, "Error: failed to write '%s'.\n", filename);
+        }
+        total += file_size;
+        continue;
+      }
+
+      fds[i] = open(filename, (backend == IO_BACKEND_MMAP ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+      if (fds[i] < 0)
+      {
+        fprintf(stderr, "Error: unable to open '%s' for writing.\n", filename);
+        status = false;
+        break;
+      }
+      ++opened;
+
+      const size_t header_size = format_ppm_header(header[i], width, height);
+      const size_t file_size = header_size + body_size;
+
+      if (backend == IO_BACKEND_WRITE)
+      {
+        // single buffered write() of the fully formatted file
+        memcpy(buffers[i], header[i], header_size);
+        format_ppm_pixels(buffers[i] + header_size, palette, data, pixel_count);
+        status = (write(fds[i], buffers[i], file_size) == (ssize_t)file_size);
+      }
+      else if (backend == IO_BACKEND_WRITEV)
+      {
+        // header and pixel text gathered from separate buffers
+        struct iovec iov[2];
+        format_ppm_pixels(buffers[i], palette, data, pixel_count);
+        iov[0].iov_base = header[i];
+        iov[0].iov_len = header_size;
+        iov[1].iov_base = buffers[i];
+        iov[1].iov_len = body_size;
+        status = (writev(fds[i], iov, 2) == (ssize_t)file_size);
+      }
+      else if (backend == IO_BACKEND_MMAP)
+      {
+        // format directly into the page cache through a shared mapping
+        status = (ftruncate(fds[i], file_size) == 0);
+        if (status)
+        {
+          char* map = mmap(0, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[i], 0);
+          if (map != MAP_FAILED)
+          {
+            memcpy(map, header[i], header_size);
+            format_ppm_pixels(map + header_size, palette, data, pixel_count);
+            munmap(map, file_size);
+          }
+          else
+          {
+            status = false;
+          }
+        }
+      }
+      else
+      {
+        memcpy(buffers[i], header[i], header_size);
+        format_ppm_pixels(buffers[i] + header_size, palette, data, pixel_count);
+        lengths[i] = file_size;
+      }
+
+      if (backend != IO_BACKEND_URING)
+      {
+        close(fds[i]);
+      }
+      total += file_size;
+
+      if (!status)
+      {
+        fprintf(stderr, "Error: failed to write '%s'.\n", filename);
+      }
+    }
+
+#ifdef __linux__
+    if (backend == IO_BACKEND_URING)
+    {
+      if (status && !uring_write_batch(&ring, fds, buffers, lengths, batch_count))
+      {
+        fprintf(stderr, "Error: io_uring write batch failed.\n");
+        status = false;
+      }
+      for (unsigned int i = 0; i < opened; ++i)
+      {
+        close(fds[i]);
+      }
+    }
+#endif
+  }
+
+  for (unsigned int i = 0; i < batch_size; ++i)
+  {
+    free(buffers[i]);
+  }
+
+#ifdef __linux__
+  if (backend == IO_BACKEND_URING)
+  {
+    uring_close(&ring);
+  }
+#endif
+
+  return status ? total : 0;
+}
+
+/**
+ * Runs the same synthetic sprite set through each output backend, for a
+ * range of file counts and sprite sizes, and reports throughput. Files are
+ * removed after each run so that every run starts from an empty directory;
+ * the timings include open/close but not fsync, so they reflect page cache
+ * throughput on disk-backed directories.
+ */
+bool bench_io(const char* dir, unsigned int file_count)
+{
+  static const char* backend_names[IO_BACKEND_COUNT] = { "stdio", "fwrite", "write", "writev", "mmap", "io_uring" };
+  static const uint8_t sizes[] = { 16, 64, 128, 255 };
+  static const unsigned int default_counts[] = { 10, 100, 1000 };
+  const unsigned int* counts = file_count ? &file_count : default_counts;
+  const unsigned int num_counts = file_count ? 1 : sizeof(default_counts) / sizeof(default_counts[0]);
+  palette_entry palette[PALETTE_SIZE_COLORS];
+  char filename[MAX_FILENAME_LEN];
+  bool status = true;
+
+  uint8_t* data = malloc(UINT8_MAX * UINT8_MAX);
+  if (!data)
+  {
+    fprintf(stderr, "Error: failed to allocate benchmark sprite buffer.\n");
+    return false;
+  }
+
+  // grayscale ramp palette and a sprite with plenty of distinct indices
+  for (int color = 0; color < PALETTE_SIZE_COLORS; ++color)
+  {
+    palette[color].r = color;
+    palette[color].g = color;
+    palette[color].b = 255 - color;
+  }
+
+  printf("Writing to %s\n", dir);
+  printf("%-9s %6s %8s %10s %10s %10s\n", "backend", "files", "size", "seconds", "files/s", "MB/s");
+
+  for (unsigned int size_index = 0; size_index < sizeof(sizes); ++size_index)
+  {
+    const uint8_t dim = sizes[size_index];
+
+    for (uint_fast16_t pixel_index = 0; pixel_index < dim * dim; ++pixel_index)
+    {
+      data[pixel_index] = (pixel_index % dim) ^ (pixel_index / dim);
+    }
+
+    for (unsigned int count_index = 0; count_index < num_counts; ++count_index)
+    {
+      for (int backend = 0; backend < IO_BACKEND_COUNT; ++backend)
+      {
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        const size_t bytes = bench_io_run(backend, dir, counts[count_index], palette, data, dim, dim);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        const double seconds = elapsed_seconds(&start, &end);
+
+        if (bytes)
+        {
+          printf("%-9s %6u %4dx%-3d %10.4f %10.0f %10.1f\n",
+                 backend_names[backend], counts[count_index], dim, dim, seconds,
+                 counts[count_index] / seconds, bytes / seconds / 1e6);
+        }
+        else
+        {
+          printf("%-9s %6u %4dx%-3d %10s\n", backend_names[backend], counts[count_index], dim, dim, "failed");
+          if (backend != IO_BACKEND_URING)
+          {
+            status = false;
+          }
+        }
+
+        for (unsigned int file_index = 0; file_index < counts[count_index]; ++file_index)
+        {
+          snprintf(filename, MAX_FILENAME_LEN - 1, "%s/bench_%05u.ppm", dir, file_index);
+          unlink(filename);
+        }
+      }
+    }
+  }
+
+  free(data);
+
+  return status;
+}
+
+/**
+ * Reads the entire contents of a file into a newly allocated buffer, which
+ * the caller must free. Returns a null pointer on failure and sets *error to
+ * a description for the caller to report, since callers differ in how they
+ * report errors.
+ */
+uint8_t* read_file(const char* filename, size_t* size, const char** error)
+{
+  uint8_t* contents = 0;
+  struct stat file_info;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd > 0)
+  {
+    if (fstat(fd, &file_info) == 0)
+    {
+      // allocate at least one byte so that empty files still succeed
+      contents = malloc(file_info.st_size ? file_info.st_size : 1);
+
+      if (contents)
+      {
+        if (read(fd, contents, file_info.st_size) == file_info.st_size)
+        {
+          *size = file_info.st_size;
+        }
+        else
+        {
+          *error = "failed to read file";
+          free(contents);
+          contents = 0;
+        }
+      }
+      else
+      {
+        *error = "failed to allocate file buffer";
+      }
+    }
+    else
+    {
+      *error = "unable to determine the file size";
+    }
+
+    close(fd);
+  }
+  else
+  {
+    *error = "failed to open file";
+  }
+
+  return contents;
+}
+
+static void put_le32(uint8_t* dst, uint32_t value)
+{
+  dst[0] = value & 0xFF;
+  dst[1] = (value >> 8) & 0xFF;
+  dst[2] = (value >> 16) & 0xFF;
+  dst[3] = (value >> 24) & 0xFF;
+}
+
+static uint32_t get_le32(const uint8_t* src)
+{
+  return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+/**
+ * Returns the largest possible compressed size for src_len input bytes.
+ */
+size_t lz_compress_bound(size_t src_len)
+{
+  return src_len + (src_len / 255) + 16;
+}
+
+/**
+ * Writes an LZ sequence length field: the part that exceeds the 4-bit token
+ * nibble is stored as a run of 255s followed by a final byte below 255.
+ */
+static uint8_t* lz_put_length(uint8_t* out, size_t length)
+{
+  length -= 15;
+  while (length >= 255)
+  {
+    *out++ = 255;
+    length -= 255;
+  }
+  *out++ = length;
+  return out;
+}
+
+/**
+ * Emits a sequence consisting of literal bytes followed by an optional match.
+ * A match_len of zero marks the final, literal-only sequence of a block.
+ */
+static uint8_t* lz_put_sequence(uint8_t* out, const uint8_t* literals, size_t literal_len,
+                                size_t offset, size_t match_len)
+{
+  const size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+  uint8_t* token = out++;
+
+  *token = ((literal_len < 15 ? literal_len : 15) << 4) | (match_code < 15 ? match_code : 15);
+
+  if (literal_len >= 15)
+  {
+    out = lz_put_length(out, literal_len);
+  }
+  memcpy(out, literals, literal_len);
+  out += literal_len;
+
+  if (match_len)
+  {
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+    if (match_code >= 15)
+    {
+      out = lz_put_length(out, match_code);
+    }
+  }
+
+  return out;
+}
+
+/**
+ * Compresses a block with a byte-oriented LZ77 codec in the style of LZ4:
+ * each sequence is a token byte (literal count, match length), the literal
+ * bytes, and a 16-bit back-reference offset. Matches are found with a single
+ * hash table probe, which keeps compression fast and decompression a plain
+ * copy loop. The destination must hold lz_compress_bound(src_len) bytes.
+ * Returns the compressed size.
+ */
+size_t lz_compress(const uint8_t* src, size_t src_len, uint8_t* dst)
+{
+  static uint32_t table[1 << LZ_HASH_BITS];
+  uint8_t* out = dst;
+  size_t anchor = 0;
+  size_t ip = 0;
+
+  // table entries hold position + 1 so that zero means "empty"
+  memset(table, 0, sizeof(table));
+
+  while (ip + LZ_MIN_MATCH <= src_len)
+  {
+    uint32_t sequence;
+    memcpy(&sequence, src + ip, sizeof(sequence));
+
+    const uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+    const size_t candidate = table[hash];
+    table[hash] = ip + 1;
+
+    if (candidate && (ip - (candidate - 1) <= LZ_MAX_OFFSET) &&
+        (memcmp(src + candidate - 1, src + ip, LZ_MIN_MATCH) == 0))
+    {
+      const size_t match_pos = candidate - 1;
+      size_t match_len = LZ_MIN_MATCH;
+
+      while ((ip + match_len < src_len) && (src[match_pos + match_len] == src[ip + match_len]))
+      {
+        ++match_len;
+      }
+
+      out = lz_put_sequence(out, src + anchor, ip - anchor, ip - match_pos, match_len);
+      ip += match_len;
+      anchor = ip;
+    }
+    else
+    {
+      ++ip;
+    }
+  }
+
+  out = lz_put_sequence(out, src + anchor, src_len - anchor, 0, 0);
+
+  return out - dst;
+}
+
+/**
+ * Reads an extended sequence length. Returns false if the input runs out.
+ */
+static bool lz_get_length(const uint8_t** in, const uint8_t* in_end, size_t* length)
+{
+  uint8_t byte;
+
+  do
+  {
+    if (*in >= in_end)
+    {
+      return false;
+    }
+    byte = *(*in)++;
+    *length += byte;
+  } while (byte == 255);
+
+  return true;
+}
+
+/**
+ * Decompresses a block produced by lz_compress() into exactly dst_len bytes.
+ * Returns false if the compressed data is malformed.
+ */
+bool lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len)
+{
+  const uint8_t* in = src;
+  const uint8_t* in_end = src + src_len;
+  size_t op = 0;
+
+  while (in < in_end)
+  {
+    const uint8_t token = *in++;
+    size_t literal_len = token >> 4;
+
+    if ((literal_len == 15) && !lz_get_length(&in, in_end, &literal_len))
+    {
+      return false;
+    }
+    if ((literal_len > (size_t)(in_end - in)) || (literal_len > dst_len - op))
+    {
+      return false;
+    }
+    memcpy(dst + op, in, literal_len);
+    in += literal_len;
+    op += literal_len;
+
+    // the final sequence carries only literals
+    if (op == dst_len)
+    {
+      return in == in_end;
+    }
+
+    if (in_end - in < 2)
+    {
+      return false;
+    }
+    const size_t offset = in[0] | (in[1] << 8);
+    size_t match_len = token & 0x0F;
+    in += 2;
+
+    if ((match_len == 15) && !lz_get_length(&in, in_end, &match_len))
+    {
+      return false;
+    }
+    match_len += LZ_MIN_MATCH;
+
+    if ((offset == 0) || (offset > op) || (match_len > dst_len - op))
+    {
+      return false;
+    }
+
+    // byte-wise copy, since the match may overlap the bytes it produces
+    for (size_t i = 0; i < match_len; ++i, ++op)
+    {
+      dst[op] = dst[op - offset];
+    }
+  }
+
+  return (op == dst_len);
+}
+
+/**
+ * Packs an SPR file into an SPZ archive. The archive layout is:
+ *
+ *   "SPZ1"                      magic
+ *   uint8_t                     sprite count, copied from the SPR
+ *   width_height_pair[count]    header, copied from the SPR
+ *   uint32_t trailer_size       bytes following the last sprite in the SPR
+ *   uint32_t offsets[count + 2] block offsets relative to the end of the table
+ *   compressed blocks           one per sprite, then one for the trailer
+ *
+ * All multibyte fields are little-endian. Each sprite's indices are
+ * compressed independently, so any one sprite can be decoded on its own
+ * with spz_read_sprite(), and spz_unpack() reproduces the SPR bit-exactly.
+ */
+bool spz_pack(const char* spr_filename, const char* spz_filename)
+{
+  bool status = false;
+  size_t spr_size = 0;
+  const char* error = 0;
+  uint8_t* spr = read_file(spr_filename, &spr_size, &error);
+
+  if (!spr)
+  {
+    fprintf(stderr, "Error: %s '%s'.\n", error, spr_filename);
+    return false;
+  }
+
+  const uint8_t num_sprites = spr_size ? spr[0] : 0;
+  const size_t header_size = 1 + (num_sprites * sizeof(width_height_pair));
+  const width_height_pair* width_height_data = (const width_height_pair*)(spr + 1);
+  const uint_fast16_t num_blocks = num_sprites + 1;
+  size_t data_size = 0;
+
+  if (spr_size >= header_size)
+  {
+    for (uint8_t sprite_index = 0; sprite_index < num_sprites; ++sprite_index)
+    {
+      data_size += width_height_data[sprite_index].width * width_height_data[sprite_index].height;
+    }
+  }
+
+  if ((spr_size < header_size) || (spr_size - header_size < data_size))
+  {
+    fprintf(stderr, "Error: '%s' is shorter than its header describes.\n", spr_filename);
+    free(spr);
+    return false;
+  }
+
+  const size_t trailer_size = spr_size - header_size - data_size;
+  const size_t table_size = 4 + ((num_blocks + 1) * 4);
+  const size_t archive_capacity = SPZ_MAGIC_LEN + header_size + table_size +
+                                  lz_compress_bound(data_size + trailer_size) + (num_blocks * 16);
+  uint8_t* archive = malloc(archive_capacity);
+
+  if (archive)
+  {
+    uint8_t* table = archive + SPZ_MAGIC_LEN + header_size;
+    uint8_t* blocks = table + table_size;
+    const uint8_t* input = spr + header_size;
+    size_t block_offset = 0;
+
+    memcpy(archive, SPZ_MAGIC, SPZ_MAGIC_LEN);
+    memcpy(archive + SPZ_MAGIC_LEN, spr, header_size);
+    put_le32(table, trailer_size);
+
+    for (uint_fast16_t block_index = 0; block_index < num_blocks; ++block_index)
+    {
+      const size_t block_size = (block_index < num_sprites) ?
+        width_height_data[block_index].width * width_height_data[block_index].height :
+        trailer_size;
+
+      put_le32(table + 4 + (block_index * 4), block_offset);
+      block_offset += lz_compress(input, block_size, blocks + block_offset);
+      input += block_size;
+    }
+    put_le32(table + 4 + (num_blocks * 4), block_offset);
+
+    const size_t archive_size = (blocks - archive) + block_offset;
+    FILE* fd = fopen(spz_filename, "wb");
+
+    if (fd)
+    {
+      if (fwrite(archive, 1, archive_size, fd) == archive_size)
+      {
+        printf("Packed %d sprites: %lu -> %lu bytes (%.1f%%)\n", num_sprites,
+               spr_size, archive_size, spr_size ? (100.0 * archive_size / spr_size) : 0.0);
+        status = true;
+      }
+      else
+      {
+        fprintf(stderr, "Error: failed to write %lu bytes to '%s'.\n", archive_size, spz_filename);
+      }
+      fclose(fd);
+    }
+    else
+    {
+      fprintf(stderr, "Error: unable to open '%s' for writing.\n", spz_filename);
+    }
+
+    free(archive);
+  }
+  else
+  {
+    fprintf(stderr, "Error: failed to allocate %lu bytes for archive.\n", archive_capacity);
+  }
+
+  free(spr);
+
+  return status;
+}
+
+/**
+ * Locates a block in an in-memory SPZ archive and returns its compressed
+ * position and size as well as its decompressed size. Block indices below
+ * the sprite count address sprites; the block at the sprite count is the
+ * trailer. Returns false if the archive is malformed.
+ */
+static bool spz_locate_block(const uint8_t* archive, size_t archive_size, uint_fast16_t block_index,
+                             size_t* position, size_t* compressed_size, size_t* size)
+{
+  if ((archive_size < SPZ_MAGIC_LEN + 1) || (memcmp(archive, SPZ_MAGIC, SPZ_MAGIC_LEN) != 0))
+  {
+    return false;
+  }
+
+  const uint8_t num_sprites = archive[SPZ_MAGIC_LEN];
+  const width_height_pair* width_height_data = (const width_height_pair*)(archive + SPZ_MAGIC_LEN + 1);
+  const size_t table_pos = SPZ_MAGIC_LEN + 1 + (num_sprites * sizeof(width_height_pair));
+  const size_t blocks_pos = table_pos + 4 + ((num_sprites + 2) * 4);
+
+  if ((block_index > num_sprites) || (archive_size < blocks_pos))
+  {
+    return false;
+  }
+
+  const size_t start = get_le32(archive + table_pos + 4 + (block_index * 4));
+  const size_t end = get_le32(archive + table_pos + 4 + ((block_index + 1) * 4));
+
+  if ((start > end) || (end > archive_size - blocks_pos))
+  {
+    return false;
+  }
+
+  *position = blocks_pos + start;
+  *compressed_size = end - start;
+  *size = (block_index < num_sprites) ?
+    width_height_data[block_index].width * width_height_data[block_index].height :
+    get_le32(archive + table_pos);
+
+  return true;
+}
+
+/**
+ * Decompresses a single sprite (or, at index == sprite count, the trailer)
+ * from an in-memory SPZ archive without touching any other block. The output
+ * buffer must hold width * height bytes for the sprite.
+ */
+bool spz_read_sprite(const uint8_t* archive, size_t archive_size, uint_fast16_t block_index, uint8_t* out)
+{
+  size_t position = 0;
+  size_t compressed_size = 0;
+  size_t size = 0;
+
+  return spz_locate_block(archive, archive_size, block_index, &position, &compressed_size, &size) &&
+         lz_decompress(archive + position, compressed_size, out, size);
+}
+
+/**
+ * Returns true if a file starts with the SPZ archive magic.
+ */
+bool is_spz_file(const char* filename)
+{
+  char magic[SPZ_MAGIC_LEN];
+  FILE* fd = fopen(filename, "rb");
+  bool spz = false;
+
+  if (fd)
+  {
+    spz = (fread(magic, 1, SPZ_MAGIC_LEN, fd) == SPZ_MAGIC_LEN) && (memcmp(magic, SPZ_MAGIC, SPZ_MAGIC_LEN) == 0);
+    fclose(fd);
+  }
+
+  return spz;
+}
+
+/**
+ * Fills an archive from an SPZ file the same way load_spr() does from an
+ * SPR file. Each sprite block is decompressed on its own, and with -x only
+ * the selected sprite is decompressed at all; the others are left with a
+ * null pixel buffer. The archive must be released with free_spr().
+ */
+bool load_spz(const char* filename, spr_archive* archive, const decode_options* options)
+{
+  bool status = true;
+  size_t spz_size = 0;
+  const char* error = 0;
+  uint8_t* spz = read_file(filename, &spz_size, &error);
+
+  memset(archive, 0, sizeof(*archive));
+
+  if (!spz)
+  {
+    log_event(LOG_ERROR, "load", filename, -1, "%s", error);
+    return false;
+  }
+
+  const uint8_t num_sprites = (spz_size > SPZ_MAGIC_LEN) ? spz[SPZ_MAGIC_LEN] : 0;
+  const size_t header_size = num_sprites * sizeof(width_height_pair);
+
+  log_event(LOG_INFO, "load", filename, -1, "%d sprites in archive", num_sprites);
+
+  archive->width_height_data = malloc(header_size ? header_size : 1);
+  if (!archive->width_height_data || (spz_size < SPZ_MAGIC_LEN + 1 + header_size))
+  {
+    log_event(LOG_ERROR, "load", filename, -1, "archive header is truncated");
+    free(spz);
+    return false;
+  }
+  memcpy(archive->width_height_data, spz + SPZ_MAGIC_LEN + 1, header_size);
+  archive->num_sprites = num_sprites;
+
+  for (uint_fast16_t sprite_index = 0; sprite_index < num_sprites; ++sprite_index)
+  {
+    const size_t pixel_count = archive->width_height_data[sprite_index].width *
+                               archive->width_height_data[sprite_index].height;
+
+    if (!pixel_count || (options->single_sprite && (sprite_index != options->sprite_index)))
+    {
+      continue;
+    }
+
+    uint8_t* pixel_data = malloc(pixel_count);
+
+    if (pixel_data && spz_read_sprite(spz, spz_size, sprite_index, pixel_data))
+    {
+      archive->pixel_data[sprite_index] = pixel_data;
+    }
+    else
+    {
+      log_event(LOG_ERROR, "load", filename, sprite_index, "failed to decompress %lu bytes of pixel data",
+                pixel_count);
+      free(pixel_data);
+      status = false;
+    }
+  }
+
+  free(spz);
+
+  return status;
+}
+
+/**
+ * Restores the original SPR file from an SPZ archive.
+ */
+bool spz_unpack(const char* spz_filename, const char* spr_filename)
+{
+  bool status = true;
+  size_t archive_size = 0;
+  const char* error = 0;
+  uint8_t* archive = read_file(spz_filename, &archive_size, &error);
+  FILE* fd = 0;
+
+  if (!archive)
+  {
+    fprintf(stderr, "Error: %s '%s'.\n", error, spz_filename);
+    return false;
+  }
+
+  if ((archive_size <= SPZ_MAGIC_LEN) || (memcmp(archive, SPZ_MAGIC, SPZ_MAGIC_LEN) != 0))
+  {
+    fprintf(stderr, "Error: '%s' is not an SPZ archive.\n", spz_filename);
+    free(archive);
+    return false;
+  }
+
+  const uint8_t num_sprites = archive[SPZ_MAGIC_LEN];
+  const size_t header_size = 1 + (num_sprites * sizeof(width_height_pair));
+
+  fd = fopen(spr_filename, "wb");
+  if (!fd)
+  {
+    fprintf(stderr, "Error: unable to open '%s' for writing.\n", spr_filename);
+    free(archive);
+    return false;
+  }
+
+  if ((archive_size < SPZ_MAGIC_LEN + header_size) ||
+      (fwrite(archive + SPZ_MAGIC_LEN, 1, header_size, fd) != header_size))
+  {
+    status = false;
+  }
+
+  for (uint_fast16_t block_index = 0; status && (block_index <= num_sprites); ++block_index)
+  {
+    size_t position = 0;
+    size_t compressed_size = 0;
+    size_t size = 0;
+
+    if (spz_locate_block(archive, archive_size, block_index, &position, &compressed_size, &size))
+    {
+      uint8_t* block = malloc(size ? size : 1);
+
+      if (block && lz_decompress(archive + position, compressed_size, block, size))
+      {
+        status = (fwrite(block, 1, size, fd) == size);
+      }
+      else
+      {
+        fprintf(stderr, "Error: failed to decompress block %lu of '%s'.\n", block_index, spz_filename);
+        status = false;
+      }
+
+      free(block);
+    }
+    else
+    {
+      fprintf(stderr, "Error: offset table of '%s' is corrupt.\n", spz_filename);
+      status = false;
+    }
+  }
+
+  if (fclose(fd) != 0)
+  {
+    status = false;
+  }
+
+  if (!status)
+  {
+    fprintf(stderr, "Error: failed to restore '%s'.\n", spr_filename);
+  }
+
+  free(archive);
+
+  return status;
+}
+
+/**
+ * Appends one run of identical sixel characters, using the "!<count>"
+ * repeat introducer for runs long enough to benefit from it.
+ */
+static char* sixel_put_run(char* out, char sixel, unsigned int run)
+{
+  if (run >= SIXEL_MIN_RUN)
+  {
+    out += sprintf(out, "!%u%c", run, sixel);
+  }
+  else
+  {
+    memset(out, sixel, run);
+    out += run;
+  }
+  return out;
+}
+
+/**
+ * Renders a sprite to stdout as a Sixel image. Sixel is palette-based, so the
+ * color registers are loaded straight from the SPR palette and the raw
+ * indices are encoded without conversion to RGB. The image is encoded one
+ * six-row band at a time: a single pass over the band builds a sixel row for
+ * each color that occurs in it, and then each of those rows is emitted
+ * run-length encoded. The whole image is buffered so that it reaches the
+ * terminal in one write.
+ */
+bool preview_sixel(uint8_t sprite_index, palette_entry* palette, uint8_t* data, uint8_t width, uint8_t height)
+{
+  static uint8_t band_rows[PALETTE_SIZE_COLORS][UINT8_MAX];
+  uint8_t band_colors[PALETTE_SIZE_COLORS];
+  bool color_used[PALETTE_SIZE_COLORS] = { false };
+  bool status = true;
+
+  // worst case per band: every color present with an unencoded row, plus
+  // the color register definitions up front
+  const size_t buffer_size = 64 + (PALETTE_SIZE_COLORS * 20) +
+    (((height + SIXEL_BAND_HEIGHT - 1) / SIXEL_BAND_HEIGHT) * (2 + (PALETTE_SIZE_COLORS * (width + 6))));
+  char* buffer = malloc(buffer_size);
+
+  if (!buffer)
+  {
+    log_event(LOG_ERROR, "preview", 0, sprite_index, "failed to allocate %lu bytes for Sixel output", buffer_size);
+    return false;
+  }
+
+  // only define the color registers that the sprite actually uses
+  for (uint_fast16_t pixel_index = 0; pixel_index < width * height; ++pixel_index)
+  {
+    color_used[data[pixel_index]] = true;
+  }
+
+  char* out = buffer;
+  out += sprintf(out, "Sprite %03d (%dx%d)\n\033P9;1q\"1;1;%d;%d", sprite_index, width, height, width, height);
+
+  for (int color = 0; color < PALETTE_SIZE_COLORS; ++color)
+  {
+    if (color_used[color])
+    {
+      out += sprintf(out, "#%d;2;%d;%d;%d", color,
+                     palette[color].r * 100 / 255,
+                     palette[color].g * 100 / 255,
+                     palette[color].b * 100 / 255);
+    }
+  }
+
+  memset(color_used, 0, sizeof(color_used));
+
+  for (uint_fast16_t band_top = 0; band_top < height; band_top += SIXEL_BAND_HEIGHT)
+  {
+    const uint_fast16_t band_height =
+      (height - band_top < SIXEL_BAND_HEIGHT) ? (height - band_top) : SIXEL_BAND_HEIGHT;
+    unsigned int num_band_colors = 0;
+
+    for (uint_fast16_t row = 0; row < band_height; ++row)
+    {
+      const uint8_t* line = data + ((band_top + row) * width);
+
+      for (uint_fast16_t x = 0; x < width; ++x)
+      {
+        const uint8_t color = line[x];
+
+        if (!color_used[color])
+        {
+          color_used[color] = true;
+          band_colors[num_band_colors++] = color;
+          memset(band_rows[color], 0, width);
+        }
+        band_rows[color][x] |= (1 << row);
+      }
+    }
+
+    for (unsigned int i = 0; i < num_band_colors; ++i)
+    {
+      const uint8_t color = band_colors[i];
+      const uint8_t* sixels = band_rows[color];
+      char current = '?' + sixels[0];
+      unsigned int run = 0;
+
+      out += sprintf(out, "#%d", color);
+
+      for (uint_fast16_t x = 0; x < width; ++x)
+      {
+        const char sixel = '?' + sixels[x];
+
+        if (sixel != current)
+        {
+          out = sixel_put_run(out, current, run);
+          current = sixel;
+          run = 0;
+        }
+        ++run;
+      }
+
+      // a trailing run of empty sixels never needs to be drawn
+      if (current != '?')
+      {
+        out = sixel_put_run(out, current, run);
+      }
+
+      *out++ = '$';
+      color_used[color] = false;
+    }
+
+    *out++ = '-';
+  }
+
+  out += sprintf(out, "\033\\\n");
+
+  if (fwrite(buffer, 1, out - buffer, stdout) != (size_t)(out - buffer))
+  {
+    status = false;
+  }
+  fflush(stdout);
+  free(buffer);
+
+  // page through the archive one sprite at a time when run interactively
+  if (status && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+  {
+    int c;
+    printf("-- press Enter for the next sprite --");
+    fflush(stdout);
+    while (((c = getchar()) != '\n') && (c != EOF))
+    {
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Looks up a name in a table of option values. Returns false if the name is
+ * not in the table.
+ */
+bool parse_name(const char* name, const char* const* names, int count, int* value)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    if (strcmp(name, names[i]) == 0)
+    {
+      *value = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Expands the palette into a lookup table of 32-bit pixels whose bytes are
+ * stored in R,G,B,A order, with every color fully opaque.
+ */
+void expand_palette_rgba(const palette_entry* palette, uint32_t* lut)
+{
+  for (int color = 0; color < PALETTE_SIZE_COLORS; ++color)
+  {
+    const uint8_t rgba[4] = { palette[color].r, palette[color].g, palette[color].b, 0xFF };
+    memcpy(&lut[color], rgba, sizeof(rgba));
+  }
+}
+
+/**
+ * Computes the stored dimensions of a sprite in the given layout. Morton
+ * order needs a power-of-two square, and tiles need whole tiles.
+ */
+void layout_padded_size(pixel_layout layout,
+                        uint_fast16_t width,
+                        uint_fast16_t height,
+                        uint_fast16_t* padded_width,
+                        uint_fast16_t* padded_height)
+{
+  if (layout == LAYOUT_MORTON)
+  {
+    uint_fast16_t side = 1;
+    while ((side < width) || (side < height))
+    {
+      side <<= 1;
+    }
+    *padded_width = side;
+    *padded_height = side;
+  }
+  else if (layout == LAYOUT_TILED)
+  {
+    *padded_width = (width + TILE_SIZE - 1) & ~(TILE_SIZE - 1);
+    *padded_height = (height + TILE_SIZE - 1) & ~(TILE_SIZE - 1);
+  }
+  else
+  {
+    *padded_width = width;
+    *padded_height = height;
+  }
+}
+
+/**
+ * Spreads the low eight bits of a coordinate so that there is a zero bit
+ * between each pair of bits, for interleaving into a Morton code.
+ */
+static uint32_t morton_spread(uint32_t value)
+{
+  value = (value | (value << 4)) & 0x0F0F;
+  value = (value | (value << 2)) & 0x3333;
+  value = (value | (value << 1)) & 0x5555;
+  return value;
+}
+
+/**
+ * Computes the destination offsets of pixels 0..count-1 of row y in the given
+ * layout. For Morton order the x bits are interleaved four pixels at a time
+ * with SSE2 and merged with the (constant) spread y bits of the row.
+ */
+void layout_row_offsets(pixel_layout layout,
+                        uint_fast16_t padded_width,
+                        uint_fast16_t padded_height,
+                        uint_fast16_t y,
+                        uint_fast16_t count,
+                        uint32_t* offsets)
+{
+  uint_fast16_t x = 0;
+
+  if (layout == LAYOUT_MORTON)
+  {
+    const uint32_t y_bits = morton_spread(y) << 1;
+
+#ifdef __SSE2__
+    const __m128i mask4 = _mm_set1_epi32(0x0F0F);
+    const __m128i mask2 = _mm_set1_epi32(0x3333);
+    const __m128i mask1 = _mm_set1_epi32(0x5555);
+    const __m128i y_vec = _mm_set1_epi32(y_bits);
+    const __m128i step = _mm_set1_epi32(4);
+    __m128i x_vec = _mm_setr_epi32(0, 1, 2, 3);
+
+    for (; x + 4 <= count; x += 4)
+    {
+      __m128i v = x_vec;
+      v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 4)), mask4);
+      v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 2)), mask2);
+      v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 1)), mask1);
+      _mm_storeu_si128((__m128i*)(offsets + x), _mm_or_si128(v, y_vec));
+      x_vec = _mm_add_epi32(x_vec, step);
+    }
+#endif
+    for (; x < count; ++x)
+    {
+      offsets[x] = morton_spread(x) | y_bits;
+    }
+  }
+  else if (layout == LAYOUT_TILED)
+  {
+    const uint32_t row_base = ((y / TILE_SIZE) * padded_width * TILE_SIZE) + ((y % TILE_SIZE) * TILE_SIZE);
+
+    for (; x < count; ++x)
+    {
+      offsets[x] = row_base + ((x / TILE_SIZE) * TILE_SIZE * TILE_SIZE) + (x % TILE_SIZE);
+    }
+  }
+  else if (layout == LAYOUT_COLUMN)
+  {
+    for (; x < count; ++x)
+    {
+      offsets[x] = (x * padded_height) + y;
+    }
+  }
+  else
+  {
+    for (; x < count; ++x)
+    {
+      offsets[x] = (y * padded_width) + x;
+    }
+  }
+}
+
+/**
+ * Reorders a sprite's pixels into the given layout. If rgba_lut is provided,
+ * the output holds 32-bit pixels expanded through the table; otherwise it
+ * holds the raw palette indices. The output buffer must be large enough for
+ * the padded size, and padding is filled with index (or color) 0.
+ */
+void swizzle_sprite(pixel_layout layout,
+                    const uint8_t* data,
+                    uint8_t width,
+                    uint8_t height,
+                    const uint32_t* rgba_lut,
+                    uint8_t* out)
+{
+  uint32_t offsets[UINT8_MAX];
+  uint_fast16_t padded_width = 0;
+  uint_fast16_t padded_height = 0;
+
+  layout_padded_size(layout, width, height, &padded_width, &padded_height);
+
+  if (rgba_lut)
+  {
+    uint32_t* out_rgba = (uint32_t*)out;
+    for (uint_fast32_t i = 0; i < padded_width * padded_height; ++i)
+    {
+      out_rgba[i] = rgba_lut[0];
+    }
+  }
+  else
+  {
+    memset(out, 0, padded_width * padded_height);
+  }
+
+  for (uint_fast16_t y = 0; y < height; ++y)
+  {
+    const uint8_t* row = data + (y * width);
+
+    layout_row_offsets(layout, padded_width, padded_height, y, width, offsets);
+
+    if (rgba_lut)
+    {
+      uint32_t* out_rgba = (uint32_t*)out;
+      for (uint_fast16_t x = 0; x < width; ++x)
+      {
+        out_rgba[offsets[x]] = rgba_lut[row[x]];
+      }
+    }
+    else
+    {
+      for (uint_fast16_t x = 0; x < width; ++x)
+      {
+        out[offsets[x]] = row[x];
+      }
+    }
+  }
+}
+
+/**
+ * Writes a fully formatted output file for a sprite in one go, logging any
+ * failure against the file and sprite index.
+ */
+bool write_output_file(const char* filename, uint8_t sprite_index, const void* buffer, size_t size)
+{
+  bool status = false;
+  FILE* fd = fopen(filename, "wb");
+
+  if (fd)
+  {
+    status = (fwrite(buffer, 1, size, fd) == size);
+    if (fclose(fd) != 0)
+    {
+      status = false;
+    }
+    if (!status)
+    {
+      log_event(LOG_ERROR, "output", filename, sprite_index, "failed to write %lu bytes", size);
+    }
+  }
+  else
+  {
+    log_event(LOG_ERROR, "output", filename, sprite_index, "unable to open file for writing");
+  }
+
+  return status;
+}
+
+/**
+ * Writes a sprite as raw palette indices or RGBA pixels in the selected
+ * layout. Since the files have no header, the layout and the stored (padded)
+ * dimensions are part of the file name.
+ */
+bool write_raw(const char* filename_base,
+               uint8_t sprite_index,
+               palette_entry* palette,
+               uint8_t* data,
+               uint8_t width,
+               uint8_t height,
+               const decode_options* options)
+{
+  bool status = false;
+  char filename[MAX_FILENAME_LEN];
+  uint32_t rgba_lut[PALETTE_SIZE_COLORS];
+  uint_fast16_t padded_width = 0;
+  uint_fast16_t padded_height = 0;
+  const bool rgba = (options->format == OUTPUT_RGBA);
+  const size_t pixel_size = rgba ? sizeof(uint32_t) : sizeof(uint8_t);
+
+  layout_padded_size(options->layout, width, height, &padded_width, &padded_height);
+
+  const size_t size = padded_width * padded_height * pixel_size;
+  uint8_t* out = malloc(size);
+
+  if (!out)
+  {
+    log_event(LOG_ERROR, "output", filename_base, sprite_index, "failed to allocate %lu bytes", size);
+    return false;
+  }
+
+  if (rgba)
+  {
+    expand_palette_rgba(palette, rgba_lut);
+  }
+  swizzle_sprite(options->layout, data, width, height, rgba ? rgba_lut : 0, out);
+
+  if (options->layout == LAYOUT_LINEAR)
+  {
+    snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d_%lux%lu.%s", filename_base, sprite_index,
+             padded_width, padded_height, output_format_names[options->format]);
+  }
+  else
+  {
+    snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d_%s_%lux%lu.%s", filename_base, sprite_index,
+             pixel_layout_names[options->layout], padded_width, padded_height,
+             output_format_names[options->format]);
+  }
+
+  status = write_output_file(filename, sprite_index, out, size);
+
+  free(out);
+
+  return status;
+}
+
+/**
+ * Opens a hardware performance counter for the calling thread, initially
+ * disabled. Returns -1 if counters are unavailable (e.g. not Linux, or
+ * perf_event_paranoid forbids it), in which case the other perf_counter_*
+ * functions do nothing.
+ */
+int perf_counter_open(uint32_t type, uint64_t config)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  (void)type;
+  (void)config;
+  return -1;
+#endif
+}
+
+/**
+ * Opens a counter of L1 data cache read misses, or returns -1 where
+ * counters are unavailable.
+ */
+int perf_counter_open_l1d_read_misses(void)
+{
+#ifdef __linux__
+  return perf_counter_open(PERF_TYPE_HW_CACHE,
+                           PERF_COUNT_HW_CACHE_L1D |
+                           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#else
+  return -1;
+#endif
+}
+
+/**
+ * Prints the footnote for benchmark tables whose counter columns read n/a.
+ */
+void perf_counter_note_unavailable(void)
+{
+  printf("Note: hardware cache counters are unavailable (check perf_event_paranoid).\n");
+}
+
+void perf_counter_start(int fd)
+{
+#ifdef __linux__
+  if (fd >= 0)
+  {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#else
+  (void)fd;
+#endif
+}
+
+uint64_t perf_counter_stop(int fd)
+{
+  uint64_t count = 0;
+
+#ifdef __linux__
+  if (fd >= 0)
+  {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+    {
+      count = 0;
+    }
+  }
+#else
+  (void)fd;
+#endif
+
+  return count;
+}
+
+/**
+ * Small deterministic PRNG (xorshift32) so that every layout sees exactly
+ * the same sample positions.
+ */
+static uint32_t xorshift32(uint32_t* state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/**
+ * Compares sampling speed and L1 data cache read misses of each pixel layout
+ * on a synthetic 255x255 RGBA texture. Addresses are computed through
+ * per-axis offset tables (offset = x_part + y_part), which every layout
+ * can be expressed with, so only the memory access
+ * pattern differs between them. Three access patterns are measured:
+ * random 4x4 footprints (filtered sampling of a minified texture), a texture
+ * walk along a 30-degree rotated direction, and vertical column spans.
+ */
+bool bench_swizzle(unsigned int sample_count)
+{
+  static const char* pattern_names[] = { "footprint", "rotated", "column" };
+  const uint8_t dim = UINT8_MAX;
+  uint32_t x_part[UINT8_MAX + TILE_SIZE];
+  uint32_t y_part[UINT8_MAX + TILE_SIZE];
+  uint32_t rgba_lut[PALETTE_SIZE_COLORS];
+  palette_entry palette[PALETTE_SIZE_COLORS];
+  uint32_t* texture = malloc(256 * 256 * sizeof(uint32_t));
+  uint8_t* data = malloc(dim * dim);
+  bool counters_available = true;
+
+  if (!texture || !data)
+  {
+    fprintf(stderr, "Error: failed to allocate benchmark texture.\n");
+    free(texture);
+    free(data);
+    return false;
+  }
+
+  for (int color = 0; color < PALETTE_SIZE_COLORS; ++color)
+  {
+    palette[color].r = color;
+    palette[color].g = color;
+    palette[color].b = color;
+  }
+  expand_palette_rgba(palette, rgba_lut);
+
+  for (uint_fast16_t pixel_index = 0; pixel_index < dim * dim; ++pixel_index)
+  {
+    data[pixel_index] = (pixel_index % dim) ^ (pixel_index / dim);
+  }
+
+  printf("%-7s %-10s %12s %10s %16s\n", "layout", "pattern", "samples", "ns/sample", "L1D misses/1k");
+
+  for (int layout = 0; layout < LAYOUT_COUNT; ++layout)
+  {
+    uint_fast16_t padded_width = 0;
+    uint_fast16_t padded_height = 0;
+
+    layout_padded_size(layout, dim, dim, &padded_width, &padded_height);
+    swizzle_sprite(layout, data, dim, dim, rgba_lut, (uint8_t*)texture);
+
+    // axis tables: offset(x, y) = offset(x, 0) + offset(0, y) holds for all layouts
+    layout_row_offsets(layout, padded_width, padded_height, 0, dim, x_part);
+    for (uint_fast16_t y = 0; y < dim; ++y)
+    {
+      layout_row_offsets(layout, padded_width, padded_height, y, 1, &y_part[y]);
+    }
+
+    for (unsigned int pattern = 0; pattern < sizeof(pattern_names) / sizeof(pattern_names[0]); ++pattern)
+    {
+      int counter = perf_counter_open_l1d_read_misses();
+      volatile uint32_t sink = 0;
+      uint32_t accumulator = 0;
+      uint32_t rng = 0x12345678;
+      unsigned int samples = 0;
+      struct timespec start, end;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      perf_counter_start(counter);
+
+      if (pattern == 0)
+      {
+        for (; samples < sample_count; samples += 16)
+        {
+          const uint32_t r = xorshift32(&rng);
+          const uint_fast16_t u = (r & 0xFFFF) % (dim - 4);
+          const uint_fast16_t v = (r >> 16) % (dim - 4);
+
+          for (int dy = 0; dy < 4; ++dy)
+          {
+            for (int dx = 0; dx < 4; ++dx)
+            {
+              accumulator += texture[x_part[u + dx] + y_part[v + dy]];
+            }
+          }
+        }
+      }
+      else if (pattern == 1)
+      {
+        // 16.16 fixed-point steps for a direction of 30 degrees
+        const int32_t du = 56756;
+        const int32_t dv = 32768;
+        uint32_t line = 0;
+
+        while (samples < sample_count)
+        {
+          int32_t u = 0;
+          int32_t v = (line++ % dim) << 16;
+
+          for (int step = 0; step < dim; ++step, ++samples)
+          {
+            accumulator += texture[x_part[(u >> 16) % dim] + y_part[(v >> 16) % dim]];
+            u += du;
+            v += dv;
+          }
+        }
+      }
+      else
+      {
+        uint32_t column = 0;
+
+        while (samples < sample_count)
+        {
+          const uint_fast16_t u = (column++ * 37) % dim;
+
+          for (uint_fast16_t v = 0; v < dim; ++v, ++samples)
+          {
+            accumulator += texture[x_part[u] + y_part[v]];
+          }
+        }
+      }
+
+      const uint64_t misses = perf_counter_stop(counter);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      sink = accumulator;
+      (void)sink;
+
+      if (counter >= 0)
+      {
+        printf("%-7s %-10s %12u %10.2f %16.2f\n", pixel_layout_names[layout], pattern_names[pattern],
+               samples, elapsed_seconds(&start, &end) * 1e9 / samples, misses * 1000.0 / samples);
+        close(counter);
+      }
+      else
+      {
+        printf("%-7s %-10s %12u %10.2f %16s\n", pixel_layout_names[layout], pattern_names[pattern],
+               samples, elapsed_seconds(&start, &end) * 1e9 / samples, "n/a");
+        counters_available = false;
+      }
+    }
+  }
+
+  if (!counters_available)
+  {
+    perf_counter_note_unavailable();
+  }
+
+  free(texture);
+  free(data);
+
+  return true;
+}
+
+// A texture prepared for the raycaster in one pixel layout. Texel (u, v)
+// is found at texels[u_offset[u] + v_offset[v]].
+typedef struct
+{
+  uint8_t* texels;
+  uint_fast16_t width;
+  uint_fast16_t height;
+  uint32_t u_offset[UINT8_MAX];
+  uint32_t v_offset[UINT8_MAX];
+} raycast_texture;
+
+// Billboard sprite placed in the raycaster map
+typedef struct
+{
+  double x;
+  double y;
+  unsigned int texture;
+} raycast_billboard;
+
+// '#' cells are walls. The benchmark camera orbits (8, 8) at radius 3,
+// which stays within the open cells 3..12 in both directions.
+static const char* const raycast_map[RAYCAST_MAP_SIZE] =
+{
+  "################",
+  "#..............#",
+  "#.##........##.#",
+  "#.#..........#.#",
+  "#..............#",
+  "#..............#",
+  "#..............#",
+  "#.#..........#.#",
+  "#.#..........#.#",
+  "#..............#",
+  "#..............#",
+  "#..............#",
+  "#.#..........#.#",
+  "#.##........##.#",
+  "#..............#",
+  "################"
+};
+
+static const raycast_billboard raycast_billboards[] =
+{
+  { 8.0, 8.0, 0 }, { 4.5, 4.5, 1 }, { 11.5, 4.5, 2 }, { 4.5, 11.5, 3 }, { 11.5, 11.5, 4 }
+};
+
+/**
+ * Renders one frame into an 8-bit indexed framebuffer with a Wolfenstein-style
+ * DDA raycaster: textured walls drawn as vertical strips, then billboard
+ * sprites depth-tested per column against the wall distances. Texels are
+ * addressed through the per-texture offset tables so that the same renderer
+ * runs unchanged on every layout.
+ */
+static void raycast_render_frame(uint8_t* framebuffer,
+                                 const raycast_texture* textures,
+                                 unsigned int num_textures,
+                                 double pos_x,
+                                 double pos_y,
+                                 double angle)
+{
+  const double dir_x = cos(angle);
+  const double dir_y = sin(angle);
+  const double plane_x = -dir_y * 0.66;
+  const double plane_y = dir_x * 0.66;
+  double depth[RAYCAST_SCREEN_WIDTH];
+
+  // ceiling and floor
+  memset(framebuffer, 1, RAYCAST_SCREEN_WIDTH * (RAYCAST_SCREEN_HEIGHT / 2));
+  memset(framebuffer + (RAYCAST_SCREEN_WIDTH * (RAYCAST_SCREEN_HEIGHT / 2)), 2,
+         RAYCAST_SCREEN_WIDTH * (RAYCAST_SCREEN_HEIGHT / 2));
+
+  for (int column = 0; column < RAYCAST_SCREEN_WIDTH; ++column)
+  {
+    const double camera_x = (2.0 * column / RAYCAST_SCREEN_WIDTH) - 1.0;
+    const double ray_x = dir_x + (plane_x * camera_x);
+    const double ray_y = dir_y + (plane_y * camera_x);
+    const double delta_x = (ray_x == 0.0) ? 1e30 : fabs(1.0 / ray_x);
+    const double delta_y = (ray_y == 0.0) ? 1e30 : fabs(1.0 / ray_y);
+    int map_x = (int)pos_x;
+    int map_y = (int)pos_y;
+    const int step_x = (ray_x < 0) ? -1 : 1;
+    const int step_y = (ray_y < 0) ? -1 : 1;
+    double side_x = (ray_x < 0) ? (pos_x - map_x) * delta_x : (map_x + 1.0 - pos_x) * delta_x;
+    double side_y = (ray_y < 0) ? (pos_y - map_y) * delta_y : (map_y + 1.0 - pos_y) * delta_y;
+    int side = 0;
+
+    do
+    {
+      if (side_x < side_y)
+      {
+        side_x += delta_x;
+        map_x += step_x;
+        side = 0;
+      }
+      else
+      {
+        side_y += delta_y;
+        map_y += step_y;
+        side = 1;
+      }
+    } while (raycast_map[map_y][map_x] != '#');
+
+    const double distance = (side == 0) ? (side_x - delta_x) : (side_y - delta_y);
+    const raycast_texture* texture = &textures[(map_x + map_y) % num_textures];
+    double wall_u = (side == 0) ? (pos_y + (distance * ray_y)) : (pos_x + (distance * ray_x));
+    wall_u -= floor(wall_u);
+
+    uint_fast16_t u = wall_u * texture->width;
+    if (u >= texture->width)
+    {
+      u = texture->width - 1;
+    }
+    if (((side == 0) && (ray_x > 0)) || ((side == 1) && (ray_y < 0)))
+    {
+      u = texture->width - u - 1;
+    }
+
+    const int line_height = (int)(RAYCAST_SCREEN_HEIGHT / ((distance > 0.01) ? distance : 0.01));
+    const int top = (RAYCAST_SCREEN_HEIGHT - line_height) / 2;
+    const int draw_top = (top < 0) ? 0 : top;
+    const int draw_bottom = (top + line_height > RAYCAST_SCREEN_HEIGHT) ? RAYCAST_SCREEN_HEIGHT : top + line_height;
+    const uint32_t v_step = ((uint32_t)texture->height << 16) / line_height;
+    uint32_t v = (draw_top - top) * v_step;
+    const uint8_t* texel_column = texture->texels + texture->u_offset[u];
+
+    for (int y = draw_top; y < draw_bottom; ++y, v += v_step)
+    {
+      framebuffer[(y * RAYCAST_SCREEN_WIDTH) + column] = texel_column[texture->v_offset[v >> 16]];
+    }
+
+    depth[column] = distance;
+  }
+
+  // billboards, farthest first
+  const unsigned int num_billboards = sizeof(raycast_billboards) / sizeof(raycast_billboards[0]);
+  unsigned int order[sizeof(raycast_billboards) / sizeof(raycast_billboards[0])];
+  double billboard_distance[sizeof(raycast_billboards) / sizeof(raycast_billboards[0])];
+
+  for (unsigned int i = 0; i < num_billboards; ++i)
+  {
+    const double dx = raycast_billboards[i].x - pos_x;
+    const double dy = raycast_billboards[i].y - pos_y;
+    billboard_distance[i] = (dx * dx) + (dy * dy);
+
+    unsigned int j = i;
+    for (; (j > 0) && (billboard_distance[order[j - 1]] < billboard_distance[i]); --j)
+    {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  const double inverse_det = 1.0 / ((plane_x * dir_y) - (dir_x * plane_y));
+
+  for (unsigned int i = 0; i < num_billboards; ++i)
+  {
+    const raycast_billboard* billboard = &raycast_billboards[order[i]];
+    const raycast_texture* texture = &textures[billboard->texture % num_textures];
+    const double dx = billboard->x - pos_x;
+    const double dy = billboard->y - pos_y;
+    const double transform_x = inverse_det * ((dir_y * dx) - (dir_x * dy));
+    const double transform_y = inverse_det * ((-plane_y * dx) + (plane_x * dy));
+
+    if (transform_y <= 0.1)
+    {
+      continue;
+    }
+
+    const int screen_x = (int)((RAYCAST_SCREEN_WIDTH / 2) * (1.0 + (transform_x / transform_y)));
+    const int size = (int)(RAYCAST_SCREEN_HEIGHT / transform_y);
+    const int top = (RAYCAST_SCREEN_HEIGHT - size) / 2;
+    const int left = screen_x - (size / 2);
+    const int draw_top = (top < 0) ? 0 : top;
+    const int draw_bottom = (top + size > RAYCAST_SCREEN_HEIGHT) ? RAYCAST_SCREEN_HEIGHT : top + size;
+    const int draw_left = (left < 0) ? 0 : left;
+    const int draw_right = (left + size > RAYCAST_SCREEN_WIDTH) ? RAYCAST_SCREEN_WIDTH : left + size;
+
+    if (size <= 0)
+    {
+      continue;
+    }
+
+    const uint32_t u_step = ((uint32_t)texture->width << 16) / size;
+    const uint32_t v_step = ((uint32_t)texture->height << 16) / size;
+
+    for (int column = draw_left; column < draw_right; ++column)
+    {
+      if (transform_y >= depth[column])
+      {
+        continue;
+      }
+
+      const uint8_t* texel_column = texture->texels + texture->u_offset[((column - left) * u_step) >> 16];
+      uint32_t v = (draw_top - top) * v_step;
+
+      for (int y = draw_top; y < draw_bottom; ++y, v += v_step)
+      {
+        const uint8_t texel = texel_column[texture->v_offset[v >> 16]];
+        if (texel != RAYCAST_TRANSPARENT_INDEX)
+        {
+          framebuffer[(y * RAYCAST_SCREEN_WIDTH) + column] = texel;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Loads sprites from an SPR file and renders a fixed camera path (one lap
+ * around the center of a small map) with a headless software raycaster, once
+ * per texture layout. Column-major matches the vertical strips a raycaster
+ * draws, row-major is what the SPR stores, and the blocked layouts sit in
+ * between. Reports frames per second and L1 data cache read misses per frame,
+ * plus a checksum of the last frame to confirm that every layout rendered
+ * the same image. Index 0 is treated as transparent for billboards.
+ */
+bool bench_raycast(const char* spr_filename, unsigned int frame_count)
+{
+  spr_archive archive;
+  raycast_texture textures[RAYCAST_MAX_TEXTURES];
+  unsigned int num_textures = 0;
+  uint8_t* framebuffer = malloc(RAYCAST_SCREEN_WIDTH * RAYCAST_SCREEN_HEIGHT);
+  bool status = load_spr(spr_filename, &archive);
+  bool counters_available = true;
+
+  memset(textures, 0, sizeof(textures));
+
+  // use the first few sprites with pixel data as textures
+  for (uint_fast16_t sprite_index = 0;
+       (sprite_index < archive.num_sprites) && (num_textures < RAYCAST_MAX_TEXTURES);
+       ++sprite_index)
+  {
+    if (archive.pixel_data[sprite_index])
+    {
+      textures[num_textures].width = archive.width_height_data[sprite_index].width;
+      textures[num_textures].height = archive.width_height_data[sprite_index].height;
+      ++num_textures;
+    }
+  }
+
+  if (!framebuffer || (num_textures == 0))
+  {
+    fprintf(stderr, "Error: no textures available for raycasting in '%s'.\n", spr_filename);
+    free(framebuffer);
+    free_spr(&archive);
+    return false;
+  }
+
+  printf("%-7s %8s %10s %10s %16s %10s\n", "layout", "frames", "seconds", "fps", "L1D misses/frame", "checksum");
+
+  for (int layout = 0; status && (layout < LAYOUT_COUNT); ++layout)
+  {
+    unsigned int texture_index = 0;
+
+    for (uint_fast16_t sprite_index = 0; status && (texture_index < num_textures); ++sprite_index)
+    {
+      raycast_texture* texture = &textures[texture_index];
+      uint_fast16_t padded_width = 0;
+      uint_fast16_t padded_height = 0;
+
+      if (!archive.pixel_data[sprite_index])
+      {
+        continue;
+      }
+
+      layout_padded_size(layout, texture->width, texture->height, &padded_width, &padded_height);
+      texture->texels = malloc(padded_width * padded_height);
+
+      if (!texture->texels)
+      {
+        fprintf(stderr, "Error: failed to allocate texture for sprite at index %lu.\n", sprite_index);
+        status = false;
+        break;
+      }
+
+      swizzle_sprite(layout, archive.pixel_data[sprite_index], texture->width, texture->height, 0, texture->texels);
+      layout_row_offsets(layout, padded_width, padded_height, 0, texture->width, texture->u_offset);
+      for (uint_fast16_t v = 0; v < texture->height; ++v)
+      {
+        layout_row_offsets(layout, padded_width, padded_height, v, 1, &texture->v_offset[v]);
+      }
+      ++texture_index;
+    }
+
+    if (status)
+    {
+      int counter = perf_counter_open_l1d_read_misses();
+      struct timespec start, end;
+      uint32_t checksum = 0;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      perf_counter_start(counter);
+
+      for (unsigned int frame = 0; frame < frame_count; ++frame)
+      {
+        const double theta = (2.0 * M_PI * frame) / frame_count;
+        raycast_render_frame(framebuffer, textures, num_textures,
+                             8.0 + (3.0 * cos(theta)), 8.0 + (3.0 * sin(theta)),
+                             theta + (M_PI / 2.0) + (0.5 * sin(3.0 * theta)));
+      }
+
+      const uint64_t misses = perf_counter_stop(counter);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      const double seconds = elapsed_seconds(&start, &end);
+
+      for (uint_fast32_t i = 0; i < RAYCAST_SCREEN_WIDTH * RAYCAST_SCREEN_HEIGHT; ++i)
+      {
+        checksum = (checksum * 31) + framebuffer[i];
+      }
+
+      if (counter >= 0)
+      {
+        printf("%-7s %8u %10.3f %10.1f %16.1f   %08X\n", pixel_layout_names[layout], frame_count,
+               seconds, frame_count / seconds, (double)misses / frame_count, checksum);
+        close(counter);
+      }
+      else
+      {
+        printf("%-7s %8u %10.3f %10.1f %16s   %08X\n", pixel_layout_names[layout], frame_count,
+               seconds, frame_count / seconds, "n/a", checksum);
+        counters_available = false;
+      }
+    }
+
+    for (unsigned int i = 0; i < num_textures; ++i)
+    {
+      free(textures[i].texels);
+      textures[i].texels = 0;
+    }
+  }
+
+  if (!counters_available)
+  {
+    perf_counter_note_unavailable();
+  }
+
+  free(framebuffer);
+  free_spr(&archive);
+
+  return status;
+}
+
+/**
+ * Parses a palette cycling range given as "<first>-<last>" or
+ * "<first>-<last>:<step>", where the step is at most the palette size in
+ * either direction.
+ */
+bool parse_cycle_range(const char* text, palette_cycle_range* range)
+{
+  char* end = 0;
+  const long first = strtol(text, &end, 10);
+
+  if ((end == text) || (*end != '-'))
+  {
+    return false;
+  }
+
+  text = end + 1;
+  const long last = strtol(text, &end, 10);
+  long step = 1;
+
+  if (end == text)
+  {
+    return false;
+  }
+  if (*end == ':')
+  {
+    text = end + 1;
+    step = strtol(text, &end, 10);
+    if (end == text)
+    {
+      return false;
+    }
+  }
+
+  if ((*end != '\0') || (first < 0) || (last >= PALETTE_SIZE_COLORS) || (first >= last) ||
+      (step < -PALETTE_SIZE_COLORS) || (step > PALETTE_SIZE_COLORS))
+  {
+    return false;
+  }
+
+  range->first = first;
+  range->last = last;
+  range->step = step;
+
+  return true;
+}
+
+/**
+ * Builds the palette for one frame of palette cycling: each range's entries
+ * are rotated by frame * step positions (towards higher indices for a
+ * positive step, as VGA color cycling does), and all other entries are
+ * copied unchanged.
+ */
+void cycle_palette(const palette_entry* palette,
+                   palette_entry* cycled,
+                   const palette_cycle_range* ranges,
+                   unsigned int num_ranges,
+                   unsigned int frame)
+{
+  memcpy(cycled, palette, PALETTE_SIZE_COLORS * sizeof(palette_entry));
+
+  for (unsigned int range_index = 0; range_index < num_ranges; ++range_index)
+  {
+    const palette_cycle_range* range = &ranges[range_index];
+    const int length = range->last - range->first + 1;
+    int shift = (int)(((long)frame * range->step) % length);
+
+    if (shift < 0)
+    {
+      shift += length;
+    }
+
+    for (int i = 0; i < length; ++i)
+    {
+      cycled[range->first + ((i + shift) % length)] = palette[range->first + i];
+    }
+  }
+}
+
+// Bit packer for GIF LZW codes, which are stored least significant bit first
+typedef struct
+{
+  uint8_t* out;
+  uint32_t bits;
+  unsigned int bit_count;
+} gif_bit_writer;
+
+static void gif_put_code(gif_bit_writer* writer, unsigned int code, unsigned int code_size)
+{
+  writer->bits |= code << writer->bit_count;
+  writer->bit_count += code_size;
+
+  while (writer->bit_count >= 8)
+  {
+    *writer->out++ = writer->bits & 0xFF;
+    writer->bits >>= 8;
+    writer->bit_count -= 8;
+  }
+}
+
+/**
+ * LZW-compresses 8-bit indices as GIF image data (without the sub-block
+ * framing). The string table is a hash of (prefix code, next byte) pairs;
+ * when it fills up, a clear code starts a new table. Returns the number of
+ * bytes written, which is at most 2 * count + 8.
+ */
+static size_t gif_lzw_encode(const uint8_t* data, size_t count, uint8_t* out)
+{
+  const unsigned int clear_code = PALETTE_SIZE_COLORS;
+  const unsigned int end_code = clear_code + 1;
+  static _Thread_local int32_t hash_keys[GIF_HASH_SIZE];
+  static _Thread_local uint16_t hash_codes[GIF_HASH_SIZE];
+  gif_bit_writer writer = { out, 0, 0 };
+  unsigned int code_size = 9;
+  unsigned int next_code = end_code + 1;
+  unsigned int prefix = data[0];
+
+  memset(hash_keys, 0xFF, sizeof(hash_keys));
+  gif_put_code(&writer, clear_code, code_size);
+
+  for (size_t i = 1; i < count; ++i)
+  {
+    const int32_t key = (prefix << 8) | data[i];
+    unsigned int slot = (unsigned int)key % GIF_HASH_SIZE;
+
+    while ((hash_keys[slot] != -1) && (hash_keys[slot] != key))
+    {
+      slot = (slot + 1) % GIF_HASH_SIZE;
+    }
+
+    if (hash_keys[slot] == key)
+    {
+      prefix = hash_codes[slot];
+      continue;
+    }
+
+    gif_put_code(&writer, prefix, code_size);
+
+    if (next_code < (1 << GIF_MAX_CODE_BITS))
+    {
+      hash_keys[slot] = key;
+      hash_codes[slot] = next_code++;
+      // the decoder builds its table one code behind the encoder
+      if ((next_code > (1u << code_size)) && (code_size < GIF_MAX_CODE_BITS))
+      {
+        ++code_size;
+      }
+    }
+    else
+    {
+      gif_put_code(&writer, clear_code, code_size);
+      memset(hash_keys, 0xFF, sizeof(hash_keys));
+      code_size = 9;
+      next_code = end_code + 1;
+    }
+
+    prefix = data[i];
+  }
+
+  gif_put_code(&writer, prefix, code_size);
+  if (next_code < (1 << GIF_MAX_CODE_BITS))
+  {
+    ++next_code;
+    if ((next_code > (1u << code_size)) && (code_size < GIF_MAX_CODE_BITS))
+    {
+      ++code_size;
+    }
+  }
+  gif_put_code(&writer, end_code, code_size);
+  gif_put_code(&writer, 0, 7); // flush the final partial byte
+
+  return writer.out - out;
+}
+
+/**
+ * Writes a sprite as a GIF. With palette cycling, the file is an endlessly
+ * looping animation whose frames all share the same LZW-compressed index
+ * data and differ only in their local color tables, so each extra frame
+ * costs one rotated palette rather than another encode.
+ */
+bool write_gif(const char* filename_base,
+               uint8_t sprite_index,
+               palette_entry* palette,
+               uint8_t* data,
+               uint8_t width,
+               uint8_t height,
+               const decode_options* options)
+{
+  static const uint8_t loop_extension[] =
+  {
+    0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00
+  };
+  bool status = false;
+  char filename[MAX_FILENAME_LEN];
+  palette_entry cycled[PALETTE_SIZE_COLORS];
+  const unsigned int frames = options->cycle_frames ? options->cycle_frames : 1;
+  const size_t pixel_count = width * height;
+  uint8_t* lzw = malloc((2 * pixel_count) + 8);
+  uint8_t* blocks = malloc((2 * pixel_count) + 8 + (((2 * pixel_count) + 8) / 255) + 2);
+
+  if (!lzw || !blocks)
+  {
+    log_event(LOG_ERROR, "output", filename_base, sprite_index, "failed to allocate GIF buffers");
+    free(lzw);
+    free(blocks);
+    return false;
+  }
+
+  // compress once, then split into length-prefixed sub-blocks
+  const size_t lzw_size = gif_lzw_encode(data, pixel_count, lzw);
+  size_t blocks_size = 0;
+
+  blocks[blocks_size++] = 8; // LZW minimum code size
+  for (size_t offset = 0; offset < lzw_size; offset += 255)
+  {
+    const size_t chunk = (lzw_size - offset < 255) ? (lzw_size - offset) : 255;
+    blocks[blocks_size++] = chunk;
+    memcpy(blocks + blocks_size, lzw + offset, chunk);
+    blocks_size += chunk;
+  }
+  blocks[blocks_size++] = 0;
+
+  snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d.gif", filename_base, sprite_index);
+  FILE* fd = fopen(filename, "wb");
+
+  if (fd)
+  {
+    const uint8_t screen[] = { 'G', 'I', 'F', '8', '9', 'a', width, 0, height, 0, 0x00, 0, 0 };
+
+    fwrite(screen, 1, sizeof(screen), fd);
+    if (frames > 1)
+    {
+      fwrite(loop_extension, 1, sizeof(loop_extension), fd);
+    }
+
+    for (unsigned int frame = 0; frame < frames; ++frame)
+    {
+      const uint8_t control[] = { 0x21, 0xF9, 0x04, 0x04, CYCLE_FRAME_DELAY_CS, 0, 0, 0 };
+      const uint8_t descriptor[] = { 0x2C, 0, 0, 0, 0, width, 0, height, 0, 0x87 };
+
+      cycle_palette(palette, cycled, options->cycle_ranges, options->num_cycle_ranges, frame);
+
+      if (frames > 1)
+      {
+        fwrite(control, 1, sizeof(control), fd);
+      }
+      fwrite(descriptor, 1, sizeof(descriptor), fd);
+      fwrite(cycled, sizeof(palette_entry), PALETTE_SIZE_COLORS, fd);
+      fwrite(blocks, 1, blocks_size, fd);
+    }
+
+    fputc(0x3B, fd);
+    status = !ferror(fd);
+
+    if ((fclose(fd) != 0) || !status)
+    {
+      log_event(LOG_ERROR, "output", filename, sprite_index, "failed to write file");
+      status = false;
+    }
+  }
+  else
+  {
+    log_event(LOG_ERROR, "output", filename, sprite_index, "unable to open file for writing");
+  }
+
+  free(lzw);
+  free(blocks);
+
+  return status;
+}
+
+/**
+ * Evaluates a reconstruction filter at distance x (in source samples).
+ */
+static float resample_filter_value(resample_filter filter, float x)
+{
+  x = fabsf(x);
+
+  if (filter == FILTER_BOX)
+  {
+    return (x <= 0.5f) ? 1.0f : 0.0f;
+  }
+  else if (filter == FILTER_BILINEAR)
+  {
+    return (x < 1.0f) ? 1.0f - x : 0.0f;
+  }
+  else if (x < 1e-6f)
+  {
+    return 1.0f;
+  }
+  else if (x < 3.0f)
+  {
+    const float pi_x = (float)M_PI * x;
+    return 3.0f * sinf(pi_x) * sinf(pi_x / 3.0f) / (pi_x * pi_x);
+  }
+
+  return 0.0f;
+}
+
+/**
+ * Computes the filter taps for resampling one axis from src_size to dst_size
+ * samples. When minifying, the filter is widened by the scale factor so that
+ * it also acts as the low-pass filter. Taps that would fall outside the
+ * source are dropped and the remaining weights renormalized, which keeps
+ * sprite edges from darkening.
+ */
+bool build_resample_kernel(resample_filter filter,
+                           uint_fast16_t src_size,
+                           uint_fast16_t dst_size,
+                           resample_kernel* kernel)
+{
+  static const float support[FILTER_COUNT] = { 0.5f, 1.0f, 3.0f };
+  const float scale = (float)dst_size / src_size;
+  const float filter_scale = (scale < 1.0f) ? scale : 1.0f;
+  const float radius = support[filter] / filter_scale;
+
+  kernel->taps = (uint_fast16_t)ceilf(radius * 2.0f) + 1;
+  kernel->first = malloc(dst_size * sizeof(int32_t));
+  kernel->count = malloc(dst_size * sizeof(int32_t));
+  kernel->weights = calloc(dst_size * kernel->taps, sizeof(float));
+
+  if (!kernel->first || !kernel->count || !kernel->weights)
+  {
+    free_resample_kernel(kernel);
+    return false;
+  }
+
+  for (uint_fast16_t i = 0; i < dst_size; ++i)
+  {
+    const float center = (i + 0.5f) / scale;
+    int32_t first = (int32_t)floorf(center - radius);
+    int32_t last = (int32_t)ceilf(center + radius);
+    float* weights = &kernel->weights[i * kernel->taps];
+    float total = 0.0f;
+
+    first = (first < 0) ? 0 : first;
+    last = (last > (int32_t)src_size) ? (int32_t)src_size : last;
+    if (last - first > (int32_t)kernel->taps)
+    {
+      last = first + kernel->taps;
+    }
+
+    for (int32_t j = first; j < last; ++j)
+    {
+      weights[j - first] = resample_filter_value(filter, (j + 0.5f - center) * filter_scale);
+      total += weights[j - first];
+    }
+
+    // a box narrower than the sample spacing can miss every tap; fall back
+    // to the nearest source sample
+    if (total <= 0.0f)
+    {
+      first = (int32_t)center;
+      first = (first >= (int32_t)src_size) ? (int32_t)src_size - 1 : first;
+      last = first + 1;
+      weights[0] = 1.0f;
+      total = 1.0f;
+    }
+
+    for (int32_t j = first; j < last; ++j)
+    {
+      weights[j - first] /= total;
+    }
+
+    kernel->first[i] = first;
+    kernel->count[i] = last - first;
+  }
+
+  return true;
+}
+
+void free_resample_kernel(resample_kernel* kernel)
+{
+  free(kernel->first);
+  free(kernel->count);
+  free(kernel->weights);
+  memset(kernel, 0, sizeof(*kernel));
+}
+
+#ifdef __SSE2__
+static inline __m128 rgba_to_ps(uint32_t pixel)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i v = _mm_cvtsi32_si128(pixel);
+  v = _mm_unpacklo_epi8(v, zero);
+  v = _mm_unpacklo_epi16(v, zero);
+  return _mm_cvtepi32_ps(v);
+}
+
+static inline uint32_t ps_to_rgba(__m128 value)
+{
+  __m128i v = _mm_cvtps_epi32(value);
+  v = _mm_packs_epi32(v, v);
+  v = _mm_packus_epi16(v, v);
+  return _mm_cvtsi128_si32(v);
+}
+#endif
+
+/**
+ * Resamples an RGBA image with separable filtering: a horizontal pass into a
+ * float intermediate of dst_width x src_height pixels (held in scratch, which
+ * must have room for 4 * dst_width * (src_height + 1) floats), then a
+ * vertical pass that accumulates whole rows so that the inner loop streams
+ * through memory. With SSE2 each RGBA pixel is processed as one 4-float
+ * vector.
+ */
+void resample_rgba(const uint32_t* src,
+                   uint_fast16_t src_width,
+                   uint_fast16_t src_height,
+                   uint32_t* dst,
+                   uint_fast16_t dst_width,
+                   uint_fast16_t dst_height,
+                   const resample_kernel* horizontal,
+                   const resample_kernel* vertical,
+                   float* scratch)
+{
+  float* row_sum = scratch + (4 * dst_width * src_height);
+
+  for (uint_fast16_t y = 0; y < src_height; ++y)
+  {
+    const uint32_t* src_row = src + (y * src_width);
+    float* out = scratch + (4 * dst_width * y);
+
+    for (uint_fast16_t x = 0; x < dst_width; ++x)
+    {
+      const uint32_t* taps = src_row + horizontal->first[x];
+      const float* weights = &horizontal->weights[x * horizontal->taps];
+      const int32_t count = horizontal->count[x];
+#ifdef __SSE2__
+      __m128 sum = _mm_setzero_ps();
+      for (int32_t t = 0; t < count; ++t)
+      {
+        sum = _mm_add_ps(sum, _mm_mul_ps(rgba_to_ps(taps[t]), _mm_set1_ps(weights[t])));
+      }
+      _mm_storeu_ps(out + (4 * x), sum);
+#else
+      float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+      for (int32_t t = 0; t < count; ++t)
+      {
+        const uint8_t* pixel = (const uint8_t*)&taps[t];
+        for (int c = 0; c < 4; ++c)
+        {
+          sum[c] += pixel[c] * weights[t];
+        }
+      }
+      memcpy(out + (4 * x), sum, sizeof(sum));
+#endif
+    }
+  }
+
+  for (uint_fast16_t y = 0; y < dst_height; ++y)
+  {
+    const float* weights = &vertical->weights[y * vertical->taps];
+    const int32_t count = vertical->count[y];
+    uint32_t* dst_row = dst + (y * dst_width);
+
+    memset(row_sum, 0, 4 * dst_width * sizeof(float));
+
+    for (int32_t t = 0; t < count; ++t)
+    {
+      const float* in = scratch + (4 * dst_width * (vertical->first[y] + t));
+#ifdef __SSE2__
+      const __m128 weight = _mm_set1_ps(weights[t]);
+      for (uint_fast16_t x = 0; x < dst_width; ++x)
+      {
+        _mm_storeu_ps(row_sum + (4 * x),
+                      _mm_add_ps(_mm_loadu_ps(row_sum + (4 * x)), _mm_mul_ps(_mm_loadu_ps(in + (4 * x)), weight)));
+      }
+#else
+      for (uint_fast32_t i = 0; i < 4 * dst_width; ++i)
+      {
+        row_sum[i] += in[i] * weights[t];
+      }
+#endif
+    }
+
+    for (uint_fast16_t x = 0; x < dst_width; ++x)
+    {
+#ifdef __SSE2__
+      dst_row[x] = ps_to_rgba(_mm_loadu_ps(row_sum + (4 * x)));
+#else
+      uint8_t pixel[4];
+      for (int c = 0; c < 4; ++c)
+      {
+        const float value = row_sum[(4 * x) + c] + 0.5f;
+        pixel[c] = (value <= 0.0f) ? 0 : (value >= 255.0f) ? 255 : (uint8_t)value;
+      }
+      memcpy(&dst_row[x], pixel, sizeof(pixel));
+#endif
+    }
+  }
+}
+
+/**
+ * Expands a sprite through the palette, resamples it to the requested size
+ * and writes it as a P3 image or as raw RGBA pixels.
+ */
+bool write_resampled(const char* filename_base,
+                     uint8_t sprite_index,
+                     palette_entry* palette,
+                     uint8_t* data,
+                     uint8_t width,
+                     uint8_t height,
+                     const decode_options* options)
+{
+  bool status = false;
+  char filename[MAX_FILENAME_LEN];
+  uint32_t rgba_lut[PALETTE_SIZE_COLORS];
+  const uint_fast16_t dst_width = options->resample_width;
+  const uint_fast16_t dst_height = options->resample_height;
+  const size_t dst_count = dst_width * dst_height;
+  const bool ppm = (options->format == OUTPUT_PPM);
+  uint32_t* src = malloc(width * height * sizeof(uint32_t));
+  uint32_t* dst = malloc(dst_count * sizeof(uint32_t));
+  float* scratch = malloc(4 * dst_width * (height + 1) * sizeof(float));
+  char* text = ppm ? malloc(PPM_MAX_HEADER_LEN + ppm_pixels_size(dst_count)) : 0;
+
+  if (!src || !dst || !scratch || (ppm && !text))
+  {
+    log_event(LOG_ERROR, "output", filename_base, sprite_index, "failed to allocate resampling buffers");
+    free(src);
+    free(dst);
+    free(scratch);
+    free(text);
+    return false;
+  }
+
+  expand_palette_rgba(palette, rgba_lut);
+  for (uint_fast16_t pixel_index = 0; pixel_index < width * height; ++pixel_index)
+  {
+    src[pixel_index] = rgba_lut[data[pixel_index]];
+  }
+
+  resample_rgba(src, width, height, dst, dst_width, dst_height,
+                &options->plan->horizontal[width], &options->plan->vertical[height], scratch);
+
+  const void* out = dst;
+  size_t size = dst_count * sizeof(uint32_t);
+
+  if (ppm)
+  {
+    snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d.ppm", filename_base, sprite_index);
+    size = snprintf(text, PPM_MAX_HEADER_LEN, "P3\n%u %u\n255",
+                    (unsigned int)dst_width, (unsigned int)dst_height);
+    size += format_ppm_rgba_pixels(text + size, dst, dst_count);
+    out = text;
+  }
+  else
+  {
+    snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d_%ux%u.rgba", filename_base, sprite_index,
+             (unsigned int)dst_width, (unsigned int)dst_height);
+  }
+
+  status = write_output_file(filename, sprite_index, out, size);
+
+  free(src);
+  free(dst);
+  free(scratch);
+  free(text);
+
+  return status;
+}
+
+// Linear-light value of every 8-bit sRGB-encoded channel value
+static float srgb_linear[256];
+static pthread_once_t srgb_linear_once = PTHREAD_ONCE_INIT;
+
+static void init_srgb_linear(void)
+{
+  for (int value = 0; value < 256; ++value)
+  {
+    const double encoded = value / 255.0;
+
+    srgb_linear[value] = (float)((encoded <= 0.04045) ? encoded / 12.92 : pow((encoded + 0.055) / 1.055, 2.4));
+  }
+}
+
+/**
+ * Converts a palette to linear-light floats, one RGBA entry (alpha 1.0) per
+ * color, so that expanding a sprite is a single table lookup per pixel.
+ */
+void expand_palette_linear(const palette_entry* palette, float (*lut)[4])
+{
+  pthread_once(&srgb_linear_once, init_srgb_linear);
+
+  for (uint_fast16_t color = 0; color < PALETTE_SIZE_COLORS; ++color)
+  {
+    lut[color][0] = srgb_linear[palette[color].r];
+    lut[color][1] = srgb_linear[palette[color].g];
+    lut[color][2] = srgb_linear[palette[color].b];
+    lut[color][3] = 1.0f;
+  }
+}
+
+/**
+ * Stores a float as its little-endian IEEE 754 bit pattern.
+ */
+static void put_le_float(uint8_t* dst, float value)
+{
+  uint32_t bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+  put_le32(dst, bits);
+}
+
+/**
+ * Appends an OpenEXR header attribute and returns the new end of the header.
+ */
+static uint8_t* exr_put_attribute(uint8_t* out, const char* name, const char* type, const void* value, uint32_t size)
+{
+  const size_t name_len = strlen(name) + 1;
+  const size_t type_len = strlen(type) + 1;
+
+  memcpy(out, name, name_len);
+  out += name_len;
+  memcpy(out, type, type_len);
+  out += type_len;
+  put_le32(out, size);
+  memcpy(out + 4, value, size);
+
+  return out + 4 + size;
+}
+
+/**
+ * Builds the header of a single-part scanline OpenEXR file holding 32-bit
+ * float B, G and R channels with no compression, followed by its (still
+ * empty) table of scanline offsets. Returns the size of the header alone.
+ */
+static size_t exr_header(uint8_t* out, uint8_t width, uint8_t height)
+{
+  uint8_t* const start = out;
+  uint8_t channels[(EXR_CHANNELS * 18) + 1] = { 0 };
+  uint8_t window[16];
+  uint8_t one[4];
+  const uint8_t zero[8] = { 0 };
+
+  // channels are stored in alphabetical order: 2 bytes of name, a 32-bit
+  // pixel type (2 = FLOAT), pLinear and padding, and x/y sampling of 1
+  for (int channel = 0; channel < EXR_CHANNELS; ++channel)
+  {
+    uint8_t* entry = &channels[channel * 18];
+
+    entry[0] = "BGR"[channel];
+    put_le32(entry + 2, 2);
+    put_le32(entry + 10, 1);
+    put_le32(entry + 14, 1);
+  }
+
+  put_le32(window, 0);
+  put_le32(window + 4, 0);
+  put_le32(window + 8, width - 1);
+  put_le32(window + 12, height - 1);
+  put_le_float(one, 1.0f);
+
+  put_le32(out, EXR_MAGIC);
+  put_le32(out + 4, EXR_VERSION);
+  out += 8;
+  out = exr_put_attribute(out, "channels", "chlist", channels, sizeof(channels));
+  out = exr_put_attribute(out, "compression", "compression", zero, 1);
+  out = exr_put_attribute(out, "dataWindow", "box2i", window, sizeof(window));
+  out = exr_put_attribute(out, "displayWindow", "box2i", window, sizeof(window));
+  out = exr_put_attribute(out, "lineOrder", "lineOrder", zero, 1);
+  out = exr_put_attribute(out, "pixelAspectRatio", "float", one, sizeof(one));
+  out = exr_put_attribute(out, "screenWindowCenter", "v2f", zero, 8);
+  out = exr_put_attribute(out, "screenWindowWidth", "float", one, sizeof(one));
+  *out++ = 0;
+
+  return out - start;
+}
+
+/**
+ * Writes a sprite as linear-light 32-bit float RGB, either as a Portable
+ * FloatMap (bottom-to-top rows of interleaved RGB) or as an uncompressed
+ * OpenEXR image (top-to-bottom scanlines of planar B, G and R). Each row is
+ * gathered into an aligned scratch row and then copied into the (unaligned)
+ * file buffer. PFM samples are stored in host byte order, which the scale
+ * sign records; OpenEXR samples are always stored little-endian.
+ */
+bool write_float(const char* filename_base,
+                 uint8_t sprite_index,
+                 palette_entry* palette,
+                 uint8_t* data,
+                 uint8_t width,
+                 uint8_t height,
+                 const decode_options* options)
+{
+  bool status = false;
+  char filename[MAX_FILENAME_LEN];
+  float lut[PALETTE_SIZE_COLORS][4];
+  // one spare float lets each PFM pixel be stored as a whole RGBA vector
+  float samples[(UINT8_MAX * EXR_CHANNELS) + 1];
+  const bool exr = (options->format == OUTPUT_EXR);
+  const size_t row_size = width * EXR_CHANNELS * sizeof(float);
+  const size_t line_size = exr ? 8 + row_size : row_size;
+  // room for the header, the EXR offset table and every scanline
+  uint8_t* out = malloc(EXR_MAX_HEADER_LEN + (height * (8 + line_size)));
+  size_t header_size = 0;
+  size_t size = 0;
+
+  if (!out)
+  {
+    log_event(LOG_ERROR, "output", filename_base, sprite_index, "failed to allocate float buffer");
+    return false;
+  }
+
+  expand_palette_linear(palette, lut);
+
+  if (exr)
+  {
+    header_size = exr_header(out, width, height);
+    size = header_size + (height * 8);
+  }
+  else
+  {
+    size = snprintf((char*)out, EXR_MAX_HEADER_LEN, "PF\n%d %d\n%s\n", width, height,
+                    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ? "-1.0" : "1.0");
+  }
+
+  for (uint_fast16_t row = 0; row < height; ++row)
+  {
+    // PFM stores the bottom row first
+    const uint_fast16_t y = exr ? row : height - 1 - row;
+    const uint8_t* indices = &data[y * width];
+    uint8_t* line = out + size;
+
+    if (exr)
+    {
+      // offset table entry (64-bit), then the scanline's y and data size
+      put_le32(out + header_size + (row * 8), size);
+      put_le32(out + header_size + (row * 8) + 4, 0);
+      put_le32(line, y);
+      put_le32(line + 4, row_size);
+
+      for (int channel = 0; channel < EXR_CHANNELS; ++channel)
+      {
+        const int component = EXR_CHANNELS - 1 - channel; // B, G, R
+        float* plane = samples + (channel * width);
+
+        for (uint_fast16_t x = 0; x < width; ++x)
+        {
+          plane[x] = lut[indices[x]][component];
+        }
+      }
+
+      for (uint_fast16_t sample = 0; sample < width * EXR_CHANNELS; ++sample)
+      {
+        put_le_float(line + 8 + (sample * sizeof(float)), samples[sample]);
+      }
+    }
+    else
+    {
+      for (uint_fast16_t x = 0; x < width; ++x)
+      {
+#ifdef __SSE2__
+        _mm_storeu_ps(samples + (3 * x), _mm_loadu_ps(lut[indices[x]]));
+#else
+        memcpy(samples + (3 * x), lut[indices[x]], 3 * sizeof(float));
+#endif
+      }
+      memcpy(line, samples, row_size);
+    }
+
+    size += line_size;
+  }
+
+  snprintf(filename, MAX_FILENAME_LEN - 1, "%s_%03d.%s", filename_base, sprite_index,
+           output_format_names[options->format]);
+
+  status = write_output_file(filename, sprite_index, out, size);
+
+  free(out);
+
+  return status;
+}
+
+// Rings of the threads that have logged so far; slots are claimed with an
+// atomic increment and published before the drain thread can read them
+static log_ring* log_rings[LOG_MAX_THREADS];
+static unsigned int log_ring_count;
+static bool log_running;
+static pthread_t log_thread;
+static _Thread_local log_ring* log_local;
+static _Thread_local bool log_unbuffered;
+
+/**
+ * Writes all of a buffer to stderr, giving up on errors other than EINTR.
+ */
+static void log_write_all(const char* data, size_t size)
+{
+  while (size > 0)
+  {
+    const ssize_t written = write(STDERR_FILENO, data, size);
+
+    if (written > 0)
+    {
+      data += written;
+      size -= written;
+    }
+    else if ((written == 0) || (errno != EINTR))
+    {
+      break;
+    }
+  }
+}
+
+/**
+ * Copies everything that has been published to the rings out to stderr.
+ * Records are whole lines and each ring has a single reader, so lines from
+ * different threads never interleave. Returns the number of bytes written.
+ */
+static size_t log_drain_rings(void)
+{
+  size_t drained = 0;
+  unsigned int count = __atomic_load_n(&log_ring_count, __ATOMIC_ACQUIRE);
+
+  count = (count < LOG_MAX_THREADS) ? count : LOG_MAX_THREADS;
+
+  for (unsigned int slot = 0; slot < count; ++slot)
+  {
+    log_ring* ring = __atomic_load_n(&log_rings[slot], __ATOMIC_ACQUIRE);
+
+    if (!ring)
+    {
+      continue;
+    }
+
+    const uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+
+    while (tail < head)
+    {
+      const size_t offset = tail & (LOG_RING_SIZE - 1);
+      const size_t available = head - tail;
+      const size_t chunk = (available < LOG_RING_SIZE - offset) ? available : LOG_RING_SIZE - offset;
+
+      log_write_all(&ring->data[offset], chunk);
+      tail += chunk;
+      drained += chunk;
+    }
+
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  return drained;
+}
+
+/**
+ * Body of the background thread that empties the rings until log_stop().
+ */
+static void* log_drain(void* arg)
+{
+  const struct timespec interval = { 0, LOG_DRAIN_INTERVAL_NS };
+
+  (void)arg;
+
+  for (;;)
+  {
+    const bool stopping = !__atomic_load_n(&log_running, __ATOMIC_ACQUIRE);
+
+    if (log_drain_rings() == 0)
+    {
+      if (stopping)
+      {
+        break;
+      }
+      nanosleep(&interval, 0);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Starts the background thread that writes log records. Until it runs (or
+ * if it cannot be started), log_event() writes each record directly.
+ */
+bool log_start(void)
+{
+  __atomic_store_n(&log_running, true, __ATOMIC_RELEASE);
+
+  if (pthread_create(&log_thread, 0, log_drain, 0) != 0)
+  {
+    __atomic_store_n(&log_running, false, __ATOMIC_RELEASE);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Writes out any remaining records and stops the drain thread. All other
+ * threads that log must have finished.
+ */
+void log_stop(void)
+{
+  if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+  {
+    return;
+  }
+
+  __atomic_store_n(&log_running, false, __ATOMIC_RELEASE);
+  pthread_join(log_thread, 0);
+
+  for (unsigned int slot = 0; (slot < log_ring_count) && (slot < LOG_MAX_THREADS); ++slot)
+  {
+    free(log_rings[slot]);
+    log_rings[slot] = 0;
+  }
+  log_ring_count = 0;
+  log_local = 0;
+}
+
+/**
+ * Returns the calling thread's ring, creating it on first use, or NULL if
+ * the record should be written directly.
+ */
+static log_ring* log_thread_ring(void)
+{
+  if (!log_local && !log_unbuffered && __atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+  {
+    const unsigned int slot = __atomic_fetch_add(&log_ring_count, 1, __ATOMIC_ACQ_REL);
+    log_ring* ring = (slot < LOG_MAX_THREADS) ? calloc(1, sizeof(log_ring)) : 0;
+
+    if (ring)
+    {
+      __atomic_store_n(&log_rings[slot], ring, __ATOMIC_RELEASE);
+      log_local = ring;
+    }
+    else
+    {
+      log_unbuffered = true;
+    }
+  }
+
+  return log_local;
+}
+
+/**
+ * Appends text as a quoted JSON string, escaping as needed and truncating
+ * it to fit. Returns the new end of the output.
+ */
+static char* log_put_string(char* out, const char* end, const char* text)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  *out++ = '"';
+  for (; *text && (end - out > 7); ++text)
+  {
+    const unsigned char c = *text;
+
+    if ((c == '"') || (c == '\\'))
+    {
+      *out++ = '\\';
+      *out++ = c;
+    }
+    else if (c < 0x20)
+    {
+      memcpy(out, "\\u00", 4);
+      out[4] = hex[c >> 4];
+      out[5] = hex[c & 0xF];
+      out += 6;
+    }
+    else
+    {
+      *out++ = c;
+    }
+  }
+  *out++ = '"';
+
+  return out;
+}
+
+/**
+ * Records an event as one JSON line on stderr, with optional file and
+ * sprite_index fields (pass NULL or -1 to leave them out). The formatted
+ * text becomes the "error" field for errors and "message" otherwise. The
+ * record is only copied into the calling thread's ring here; formatting
+ * takes no locks and the write to stderr happens on the drain thread.
+ */
+void log_event(log_level level, const char* stage, const char* file, int sprite_index, const char* format, ...)
+{
+  char record[LOG_MAX_RECORD];
+  char text[LOG_MAX_RECORD / 2];
+  const char* const end = record + sizeof(record) - 3; // room for '"', '}' and '\n'
+  struct timespec now;
+  va_list args;
+  char* out = record;
+
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  out += snprintf(out, end - out, "{\"time\":%ld.%06ld,\"level\":\"%s\",\"stage\":",
+                  (long)now.tv_sec, now.tv_nsec / 1000, (level == LOG_ERROR) ? "error" : "info");
+  out = log_put_string(out, end, stage);
+  if (file)
+  {
+    // leave room for the sprite index and the message key
+    memcpy(out, ",\"file\":", 8);
+    out = log_put_string(out + 8, end - 64, file);
+  }
+  if (sprite_index >= 0)
+  {
+    out += snprintf(out, end - out, ",\"sprite_index\":%d", sprite_index);
+  }
+  out += snprintf(out, end - out, (level == LOG_ERROR) ? ",\"error\":" : ",\"message\":");
+  out = log_put_string(out, end, text);
+  *out++ = '}';
+  *out++ = '\n';
+
+  const size_t size = out - record;
+  log_ring* ring = log_thread_ring();
+
+  if (!ring)
+  {
+    log_write_all(record, size);
+    return;
+  }
+
+  // wait for the drain thread only if the ring is full
+  while (ring->head + size - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > LOG_RING_SIZE)
+  {
+    sched_yield();
+  }
+
+  const size_t offset = ring->head & (LOG_RING_SIZE - 1);
+  const size_t first = (size < LOG_RING_SIZE - offset) ? size : LOG_RING_SIZE - offset;
+
+  memcpy(&ring->data[offset], record, first);
+  memcpy(ring->data, record + first, size - first);
+  __atomic_store_n(&ring->head, ring->head + size, __ATOMIC_RELEASE);
+}